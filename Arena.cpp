@@ -0,0 +1,112 @@
+/**
+ * @file Arena.cpp - implementation of Arena
+ * @see "Seattle University, CPSC5300, Spring 2020"
+ */
+#include <cstdint>
+#include <cstring>
+#include "Arena.h"
+
+Arena::Chunk *Arena::free_chunks = nullptr;
+size_t Arena::free_count = 0;
+
+Arena::Arena() : chunks(nullptr), cursor(nullptr), limit(nullptr), finalizers(nullptr), allocated(0),
+                 dictionary(nullptr), dictionary_capacity(0), dictionary_count(0) {
+}
+
+// Run the destructors for everything made here, then give back the chunks.
+Arena::~Arena() {
+    for (Finalizer *f = finalizers; f != nullptr; f = f->next)
+        f->destroy(f->object);
+    while (chunks != nullptr) {
+        Chunk *chunk = chunks;
+        chunks = chunk->next;
+        if (chunk->size == CHUNK_SZ && free_count < MAX_FREE_CHUNKS) {
+            chunk->next = free_chunks;
+            free_chunks = chunk;
+            free_count++;
+        } else {
+            ::operator delete(chunk);
+        }
+    }
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+    uintptr_t at = ((uintptr_t) cursor + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    if (cursor == nullptr || at + size > (uintptr_t) limit) {
+        new_chunk(size + alignment);
+        at = ((uintptr_t) cursor + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    }
+    cursor = (char *) (at + size);
+    allocated += size;
+    return (void *) at;
+}
+
+// Start carving from a new chunk big enough for size bytes (reusing a released one if possible).
+void Arena::new_chunk(size_t size) {
+    Chunk *chunk;
+    if (size <= CHUNK_SZ && free_chunks != nullptr) {
+        chunk = free_chunks;
+        free_chunks = chunk->next;
+        free_count--;
+    } else {
+        size_t usable = size <= CHUNK_SZ ? CHUNK_SZ : size;
+        chunk = static_cast<Chunk *>(::operator new(sizeof(Chunk) + usable));
+        chunk->size = usable;
+    }
+    chunk->next = chunks;
+    chunks = chunk;
+    cursor = (char *) (chunk + 1);
+    limit = cursor + chunk->size;
+}
+
+// Remember to destroy object when the arena goes away.
+void Arena::at_release(void (*destroy)(void *), void *object) {
+    Finalizer *f = static_cast<Finalizer *>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+    f->destroy = destroy;
+    f->object = object;
+    f->next = finalizers;
+    finalizers = f;
+}
+
+// FNV-1a
+static size_t hash_chars(const char *chars, size_t size) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (unsigned char) chars[i]) * 16777619u;
+    return hash;
+}
+
+const char *Arena::intern(const char *chars, size_t size) {
+    if (2 * (dictionary_count + 1) > dictionary_capacity)
+        grow_dictionary();
+    size_t hash = hash_chars(chars, size);
+    size_t slot = hash & (dictionary_capacity - 1);
+    while (dictionary[slot].chars != nullptr) {
+        Interned &entry = dictionary[slot];
+        if (entry.hash == hash && entry.size == size && memcmp(entry.chars, chars, size) == 0)
+            return entry.chars;
+        slot = (slot + 1) & (dictionary_capacity - 1);
+    }
+    char *copy = static_cast<char *>(allocate(size, 1));
+    memcpy(copy, chars, size);
+    dictionary[slot] = {copy, size, hash};
+    dictionary_count++;
+    return copy;
+}
+
+// Double the dictionary's table (the old one is simply abandoned in the arena).
+void Arena::grow_dictionary() {
+    size_t capacity = dictionary_capacity == 0 ? 64 : 2 * dictionary_capacity;
+    Interned *table = static_cast<Interned *>(allocate(capacity * sizeof(Interned), alignof(Interned)));
+    memset(table, 0, capacity * sizeof(Interned));
+    for (size_t i = 0; i < dictionary_capacity; i++) {
+        if (dictionary[i].chars == nullptr)
+            continue;
+        size_t slot = dictionary[i].hash & (capacity - 1);
+        while (table[slot].chars != nullptr)
+            slot = (slot + 1) & (capacity - 1);
+        table[slot] = dictionary[i];
+    }
+    dictionary = table;
+    dictionary_capacity = capacity;
+}
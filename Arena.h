@@ -0,0 +1,162 @@
+/**
+ * @file Arena.h - Per-statement memory arena.
+ * Arena
+ * ArenaAllocator
+ *
+ * @see "Seattle University, CPSC5300, Spring 2020"
+ */
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @class Arena - monotonic (bump) allocator for everything one statement produces
+ *
+ * Memory is carved out of large chunks and is never given back piecemeal; it all goes at once when the
+ * arena is deleted. Objects built with make() have their destructors run at that time, in reverse order
+ * of construction. Released chunks are kept on a free list and reused by the next statement's arena.
+ *
+ * The arena also keeps a string dictionary, so a TEXT value that turns up in many rows of a result is
+ * stored once and shared by all of them.
+ */
+class Arena {
+public:
+    /**
+     * Size of the chunks memory is carved from (bigger requests get a chunk of their own)
+     */
+    static const size_t CHUNK_SZ = 64 * 1024;
+
+    /**
+     * Number of released chunks kept around for reuse
+     */
+    static const size_t MAX_FREE_CHUNKS = 64;
+
+    Arena();
+
+    virtual ~Arena();
+
+    Arena(const Arena &other) = delete;
+
+    Arena(Arena &&temp) = delete;
+
+    Arena &operator=(const Arena &other) = delete;
+
+    Arena &operator=(Arena &&temp) = delete;
+
+    /**
+     * Get some raw memory from the arena.
+     * @param size       number of bytes needed
+     * @param alignment  required alignment (a power of 2)
+     * @returns          the memory (valid until the arena is deleted)
+     */
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * Construct an object in the arena. It is destroyed when the arena is.
+     * @param args  constructor arguments
+     * @returns     the new object (must not be deleted by the caller)
+     */
+    template<typename T, typename... Args>
+    T *make(Args &&... args) {
+        void *memory = allocate(sizeof(T), alignof(T));
+        T *object = new(memory) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            at_release(destroy<T>, object);
+        return object;
+    }
+
+    /**
+     * Get the arena's copy of some characters, shared with every other request for the same characters.
+     * @param chars  the characters
+     * @param size   number of characters
+     * @returns      the arena's copy (valid until the arena is deleted)
+     */
+    const char *intern(const char *chars, size_t size);
+
+    /**
+     * Number of bytes handed out so far.
+     */
+    size_t get_allocated() const { return allocated; }
+
+protected:
+    struct Chunk {
+        Chunk *next;
+        size_t size;  // usable bytes following the header
+    };
+    struct Finalizer {
+        void (*destroy)(void *);
+        void *object;
+        Finalizer *next;
+    };
+
+    struct Interned {
+        const char *chars;  // nullptr for an empty slot
+        size_t size;
+        size_t hash;
+    };
+
+    Chunk *chunks;
+    char *cursor;
+    char *limit;
+    Finalizer *finalizers;
+    size_t allocated;
+    Interned *dictionary;        // open-addressed hash table, itself in the arena
+    size_t dictionary_capacity;  // a power of 2 (0 until the first intern)
+    size_t dictionary_count;
+
+    static Chunk *free_chunks;
+    static size_t free_count;
+
+    void new_chunk(size_t size);
+
+    void at_release(void (*destroy)(void *), void *object);
+
+    void grow_dictionary();
+
+    template<typename T>
+    static void destroy(void *object) { static_cast<T *>(object)->~T(); }
+};
+
+
+/**
+ * @class ArenaAllocator - standard allocator that draws from an Arena, or from the heap if it has none
+ *
+ * Deallocation is a no-op for arena memory. Copying a container gives the copy a heap allocator, so
+ * values copied out of a statement's results outlive its arena safely.
+ */
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator() : arena(nullptr) {}
+
+    explicit ArenaAllocator(Arena *arena) : arena(arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n) {
+        if (arena == nullptr)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (arena == nullptr)
+            ::operator delete(p);
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+    Arena *arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
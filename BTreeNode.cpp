@@ -4,6 +4,7 @@
  * @see "Seattle University, CPSC5300, Spring 2020"
  */
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 
@@ -55,31 +56,7 @@ Handle BTreeNode::get_handle(RecordID record_id) const {
 // Get the record and turn it into a KeyValue.
 KeyValue *BTreeNode::get_key(RecordID record_id) const {
     Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
-    KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const &data_type: this->key_profile) {
-        value.data_type = data_type;
-        if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *) (bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
-        }
-        key_value->push_back(value);
-    }
+    KeyValue *key_value = new KeyValue((char *) dbt->get_data(), dbt->get_size());
     delete dbt;
     return key_value;
 }
@@ -101,49 +78,105 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
-// Convert KeyValue into bytes.
+// Convert KeyValue into bytes (it already is bytes; this just checks the size and makes the Dbt).
 Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
+    if (key->size() > DbBlock::BLOCK_SZ)
+        throw DbRelationError("index key too big to marshal");
+    char *bytes = new char[key->size()];
+    memcpy(bytes, key->data(), key->size());
+    return new Dbt(bytes, (u_int32_t) key->size());
+}
 
-        if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
+void BTreeNode::append_key_column(KeyValue &key, ColumnAttribute::DataType data_type, const Value &value) {
+    if (data_type == ColumnAttribute::DataType::INT) {
+        uint32_t n = (uint32_t) value.n ^ 0x80000000u;
+        for (int shift = 24; shift >= 0; shift -= 8)
+            key.push_back((char) (n >> shift));
+    } else if (data_type == ColumnAttribute::DataType::TEXT) {
+        const char *chars = value.text_data();
+        for (uint i = 0; i < value.text_size(); i++) {
+            key.push_back(chars[i]);
+            if (chars[i] == '\0')
+                key.push_back('\xff');
+        }
+        key.append(2, '\0');
+    } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+        key.push_back((char) (uint8_t) value.n);
+    } else {
+        throw DbRelationError("Only know how to marshal INT, TEXT, or BOOLEAN");
+    }
+}
 
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
+void BTreeNode::append_key_handle(KeyValue &key, Handle handle) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        key.push_back((char) (handle.first >> shift));
+    key.push_back((char) (handle.second >> 8));
+    key.push_back((char) handle.second);
+}
 
+vector<Value> BTreeNode::decode_key(const KeyValue &key, const KeyProfile &key_profile) {
+    vector<Value> values;
+    const unsigned char *bytes = (const unsigned char *) key.data();
+    uint offset = 0;
+    for (auto const &data_type: key_profile) {
+        if (offset >= key.size())
+            break;  // a partial key
+        if (data_type == ColumnAttribute::DataType::INT) {
+            uint32_t n = 0;
+            for (int i = 0; i < 4; i++, offset++)
+                n = (n << 8) | (offset < key.size() ? bytes[offset] : 0);  // separators may be cut short
+            values.push_back(Value((int32_t) (n ^ 0x80000000u)));
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint16_t *) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
+            string text;
+            while (offset < key.size() && !(bytes[offset] == 0 && (offset + 1 >= key.size() || bytes[offset + 1] == 0))) {
+                text.push_back((char) bytes[offset]);
+                offset += bytes[offset] == 0 ? 2 : 1;
+            }
+            offset += 2;
+            values.push_back(Value(text));
+        } else {
+            Value value(bytes[offset++]);
+            value.data_type = data_type;
+            values.push_back(value);
+        }
+    }
+    return values;
+}
 
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
+uint BTreeNode::common_prefix(const KeyValue &a, const KeyValue &b) {
+    uint n = (uint) min(a.size(), b.size());
+    uint i = 0;
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
 
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
+KeyValue BTreeNode::shortest_separator(const KeyValue &left, const KeyValue &right) {
+    return right.substr(0, common_prefix(left, right) + 1);
+}
 
-        } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
-        }
+// Halving the bytes rather than the entries keeps a few big keys from all landing on one side; from the middle,
+// try the candidates on either side in turn until one fits both ways.
+size_t BTreeNode::split_point(const vector<uint> &sizes, size_t lo, size_t hi,
+                              const function<bool(size_t)> &splits) {
+    if (lo >= hi)
+        return hi;
+    uint total = 0;
+    for (uint size: sizes)
+        total += size;
+    uint left = 0;
+    for (size_t i = 0; i < lo; i++)
+        left += sizes[i];
+    size_t middle = lo;
+    for (; middle < hi - 1 && 2 * (left + sizes[middle]) <= total; middle++)
+        left += sizes[middle];
+    for (size_t distance = 0; middle >= lo + distance || middle + distance < hi; distance++) {
+        if (middle + distance < hi && splits(middle + distance))
+            return middle + distance;
+        if (distance > 0 && middle >= lo + distance && splits(middle - distance))
+            return middle - distance;
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    return hi;
 }
 
 
@@ -207,7 +240,8 @@ BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile
             } else {
                 // key
                 KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
+                this->boundaries.push_back(*key_value);
+                delete key_value;
             }
             i++;
         }
@@ -216,24 +250,25 @@ BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile
 }
 
 BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
 }
 
 // Get next block down in tree where key must be.
 BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
-    }
+    BlockID down = find_child(key);
+    if (depth == 2)
+        return new BTreeLeaf(this->file, down, this->key_profile, false);
+    else
+        return new BTreeInterior(this->file, down, this->key_profile, false);
+}
+
+BlockID BTreeInterior::find_child(const KeyValue *key) const {
+    // the child to the left of the first boundary greater than key
+    auto above = upper_bound(this->boundaries.begin(), this->boundaries.end(), *key);
+    return above == this->boundaries.begin() ? this->first : this->pointers[above - this->boundaries.begin() - 1];
+}
+
+BTreeNode *BTreeInterior::edge(bool last, uint depth) const {
+    BlockID down = last && !this->pointers.empty() ? this->pointers.back() : this->first;
     if (depth == 2)
         return new BTreeLeaf(this->file, down, this->key_profile, false);
     else
@@ -250,7 +285,7 @@ void BTreeInterior::save() {
     delete dbt;
     for (uint i = 0; i < this->boundaries.size(); i++) {
         // key
-        dbt = marshal_key(this->boundaries[i]);
+        dbt = marshal_key(&this->boundaries[i]);
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
@@ -269,57 +304,38 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
     // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
     // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
 
-    Dbt *dbt;
-
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
-    dbt = marshal_block_id(block_id);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(boundary);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
+    auto at = upper_bound(this->boundaries.begin(), this->boundaries.end(), *boundary) - this->boundaries.begin();
+    this->pointers.insert(this->pointers.begin() + at, block_id);
+    this->boundaries.insert(this->boundaries.begin() + at, *boundary);
+    if (fits()) {
         save();
         return BTreeNode::insertion_none();
-
-    } catch (DbBlockNoRoomError &e) {
+    } else {
         cout << "splitting " << *this << endl; // DEBUG
-        delete[] (char *) dbt->get_data();
-        delete dbt;
 
         // too big, so split
 
+        // only the pointer of the entry split at goes into the sister (as it's first pointer)
+        // the corresponding boundary is moved up to be inserted into the parent node
+        vector<uint> sizes;
+        for (auto const &boundary: this->boundaries)
+            sizes.push_back((uint) (boundary.size() + sizeof(BlockID)));
+        u_long n = this->boundaries.size();
+        u_long split = split_point(sizes, 0, n, [this, n](size_t i) {
+            return fits(0, i) && fits(i + 1, n);
+        });
+        if (split == n) {
+            this->pointers.erase(this->pointers.begin() + at);
+            this->boundaries.erase(this->boundaries.begin() + at);
+            throw DbRelationError("index boundaries too big to split an interior node");
+        }
+
         // create the sister
         BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
-
-        // only the pointer of the middle entry goes into the sister (as it's first pointer)
-        // the corresponding boundary is moved up to be inserted into the parent node
-        u_long split = this->boundaries.size() / 2;
         nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
+        Insertion ret(nnode->id, this->boundaries[split]);
 
-        // move half of the entries to the sister
+        // move the entries after it to the sister
         for (u_long i = split + 1; i < this->boundaries.size(); i++) {
             nnode->boundaries.push_back(this->boundaries[i]);
             nnode->pointers.push_back(this->pointers[i]);
@@ -332,10 +348,23 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
         // save everything
         nnode->save();
         this->save();
+        delete nnode;
         return ret;
     }
 }
 
+// Whether the first pointer and all the boundary/pointer pairs fit in one block.
+bool BTreeInterior::fits() const {
+    return fits(0, this->boundaries.size());
+}
+
+bool BTreeInterior::fits(size_t begin, size_t end) const {
+    uint bytes = (uint) (sizeof(BlockID) * (1 + end - begin));
+    for (size_t i = begin; i < end; i++)
+        bytes += (uint) this->boundaries[i].size();
+    return SlottedPage::would_fit((uint) (1 + 2 * (end - begin)), bytes);
+}
+
 
 ostream &operator<<(ostream &out, const BTreeInterior &node) {
     out << "(interior block " << node.id << "): " << node.first;
@@ -343,7 +372,7 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
         out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
     } else {
         for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+            out << '|' << BTreeNode::decode_key(node.boundaries[i], node.key_profile)[0] << '|' << node.pointers[i];
     }
     return out;
 }
@@ -361,19 +390,21 @@ BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                      key_map() {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
+        KeyValue *prefix = record_id_list->empty() ? new KeyValue() : get_key(1);
         RecordID i = 1;
         for (auto j = record_id_list->size(); j > 0; j--) {
             if (i == record_id_list->size()) {
                 // next leaf block
                 this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
-                delete key_value;
+            } else if (i % 2 != 0 && i > 1) {
+                // record i-1: handle, record i: key suffix
+                KeyValue *suffix = get_key(i);
+                this->key_map[*prefix + *suffix] = get_handle(i - 1);
+                delete suffix;
             }
             i++;
         }
+        delete prefix;
         delete record_id_list;
     }
 }
@@ -391,10 +422,46 @@ bool BTreeLeaf::contains(const KeyValue *key) {
     return it != this->key_map.end();
 }
 
-// Save the key_map and next_leaf data in the correct order
+bool BTreeLeaf::find_prefix(const KeyValue *prefix, Handles *handles) const {
+    for (auto it = this->key_map.lower_bound(*prefix); it != this->key_map.end(); it++) {
+        if (it->first.compare(0, prefix->size(), *prefix) != 0)
+            return false;
+        handles->push_back(it->second);
+    }
+    return true;
+}
+
+bool BTreeLeaf::find_range(const KeyValue *min_key, const KeyValue *max_key, Handles *handles) const {
+    for (auto it = this->key_map.lower_bound(*min_key); it != this->key_map.end(); it++) {
+        if (max_key != nullptr && it->first.compare(0, max_key->size(), *max_key) > 0)
+            return false;
+        handles->push_back(it->second);
+    }
+    return true;
+}
+
+bool BTreeLeaf::edge(bool last, Handle &handle) const {
+    if (this->key_map.empty())
+        return false;
+    handle = last ? this->key_map.rbegin()->second : this->key_map.begin()->second;
+    return true;
+}
+
+BTreeLeaf *BTreeLeaf::next() const {
+    if (this->next_leaf == 0)
+        return nullptr;
+    return new BTreeLeaf(this->file, this->next_leaf, this->key_profile, false);
+}
+
+// Save the key_map and next_leaf data in the correct order: the keys' common prefix, then each handle
+// followed by the rest of its key, then the next leaf pointer.
 void BTreeLeaf::save() {
     Dbt *dbt;
     this->block->clear();
+    uint prefix = common_prefix();
+    const char *prefix_bytes = this->key_map.empty() ? "" : this->key_map.begin()->first.data();
+    Dbt prefix_dbt((void *) prefix_bytes, prefix);
+    this->block->add(&prefix_dbt);
     for (auto const &item: this->key_map) {
         // handle
         dbt = marshal_handle(item.second);
@@ -402,11 +469,9 @@ void BTreeLeaf::save() {
         delete[] (char *) dbt->get_data();
         delete dbt;
 
-        // key
-        dbt = marshal_key(&item.first);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        // key suffix
+        Dbt suffix_dbt((void *) (item.first.data() + prefix), (u_int32_t) (item.first.size() - prefix));
+        this->block->add(&suffix_dbt);
     }
     // next leaf pointer is final record
     dbt = marshal_block_id(this->next_leaf);
@@ -420,61 +485,78 @@ void BTreeLeaf::save() {
 // Insert key, handle pair into block.
 Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
     // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
-    // check unique
+    // check unique (entries of a non-unique index have their handle in the key, so they never collide)
     if (this->key_map.find(*key) != this->key_map.end())
         throw DbRelationError("Duplicate keys are not allowed in unique index");
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+    // keys under a quarter of a block leave room to split a full leaf (by bytes) into two halves that fit
+    if (key->size() > DbBlock::BLOCK_SZ / 4)
+        throw DbRelationError("index key too big to marshal");
+    this->key_map[*key] = handle;
+    if (fits()) {
         save();
         return BTreeNode::insertion_none();
-
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
+    } else {
+        // too big, so split where each side fits with its own common prefix
+        vector<uint> sizes;
+        vector<map<KeyValue, Handle>::const_iterator> entries;
+        for (auto item = this->key_map.cbegin(); item != this->key_map.cend(); item++) {
+            sizes.push_back((uint) (sizeof(BlockID) + sizeof(RecordID) + item->first.size()));
+            entries.push_back(item);
+        }
+        size_t split = split_point(sizes, 1, entries.size(), [this, &entries](size_t at) {
+            return fits(this->key_map.cbegin(), entries[at]) && fits(entries[at], this->key_map.cend());
+        });
+        if (split == entries.size()) {
+            this->key_map.erase(*key);
+            throw DbRelationError("index keys too big to split a leaf");
+        }
 
         // create the sister and put her to the right
         BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
         nleaf->next_leaf = this->next_leaf;
         this->next_leaf = nleaf->id;
 
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const &item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
-            }
-            i++;
-        }
+        // move the upper entries to the sister
+        auto moving = this->key_map.begin();
+        advance(moving, split);
+        KeyValue boundary = shortest_separator(prev(moving)->first, moving->first);
+        nleaf->key_map.insert(moving, this->key_map.end());
+        this->key_map.erase(moving, this->key_map.end());
         cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
+        cout << " starting at value " << decode_key(boundary, this->key_profile)[0] << endl; // DEBUG
 
         nleaf->save();
         this->save();
-        return Insertion(nleaf->id, boundary);
+        BlockID nleaf_id = nleaf->id;
+        delete nleaf;
+        return Insertion(nleaf_id, boundary);
     }
 }
+
+bool BTreeLeaf::del(const KeyValue *key) {
+    return this->key_map.erase(*key) > 0;
+}
+
+// Length of the prefix shared by all the keys (that of the first and last key, since they are sorted).
+uint BTreeLeaf::common_prefix() const {
+    if (this->key_map.empty())
+        return 0;
+    return BTreeNode::common_prefix(this->key_map.begin()->first, this->key_map.rbegin()->first);
+}
+
+// Whether the prefix record, the handle/suffix pairs, and the next leaf pointer fit in one block.
+bool BTreeLeaf::fits() const {
+    return fits(this->key_map.cbegin(), this->key_map.cend());
+}
+
+bool BTreeLeaf::fits(map<KeyValue, Handle>::const_iterator begin, map<KeyValue, Handle>::const_iterator end) {
+    if (begin == end)
+        return SlottedPage::would_fit(2, (uint) sizeof(BlockID));
+    uint prefix = BTreeNode::common_prefix(begin->first, prev(end)->first);
+    uint bytes = prefix + (uint) sizeof(BlockID);
+    uint count = 0;
+    for (auto item = begin; item != end; item++, count++)
+        bytes += (uint) (sizeof(BlockID) + sizeof(RecordID) + item->first.size() - prefix);
+    return SlottedPage::would_fit(2 * count + 2, bytes);
+}
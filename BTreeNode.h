@@ -6,12 +6,13 @@
  */
 #pragma once
 
+#include <functional>
 #include "storage_engine.h"
 #include "heap_storage.h"
 
 typedef std::vector<ColumnAttribute::DataType> KeyProfile;
-typedef std::vector<Value> KeyValue;
-typedef std::vector<KeyValue *> KeyValues;
+typedef std::string KeyValue;  // normalized key bytes (see BTreeNode::append_key_column)
+typedef std::vector<KeyValue> KeyValues;
 typedef std::vector<BlockID> BlockPointers;
 typedef std::pair<BlockID, KeyValue> Insertion;
 
@@ -29,6 +30,46 @@ public:
 
     BlockID get_id() const { return this->id; }
 
+    /**
+     * Add one column to a normalized key. Normalized keys compare with memcmp (i.e., as std::strings) in
+     * the same order as the Values they encode, column by column: INT is 4 big-endian bytes with the sign
+     * bit flipped, BOOLEAN is 1 byte, and TEXT is its characters with each 0x00 escaped as 0x00 0xFF,
+     * followed by a 0x00 0x00 terminator (so a string sorts before any longer string it is a prefix of).
+     * @param key        the key so far
+     * @param data_type  type of the column
+     * @param value      value for the column
+     */
+    static void append_key_column(KeyValue &key, ColumnAttribute::DataType data_type, const Value &value);
+
+    /**
+     * Add a handle to a normalized key, big-endian, so that entries for the same key value (in a
+     * non-unique index) are distinct and sorted by where their rows are in the relation.
+     * @param key     the key so far
+     * @param handle  the row the index entry is for
+     */
+    static void append_key_handle(KeyValue &key, Handle handle);
+
+    /**
+     * Turn a normalized key back into its column values (for display).
+     * @param key          the key
+     * @param key_profile  its column types
+     * @returns            the values
+     */
+    static std::vector<Value> decode_key(const KeyValue &key, const KeyProfile &key_profile);
+
+    /**
+     * Length of the longest common prefix of two keys.
+     */
+    static uint common_prefix(const KeyValue &a, const KeyValue &b);
+
+    /**
+     * Shortest key that separates two adjacent keys: greater than left and no greater than right.
+     * @param left   the greatest key going to the left
+     * @param right  the least key going to the right (must be greater than left)
+     * @returns      a prefix of right
+     */
+    static KeyValue shortest_separator(const KeyValue &left, const KeyValue &right);
+
 protected:
     SlottedPage *block;
     HeapFile &file;
@@ -46,6 +87,17 @@ protected:
     virtual Handle get_handle(RecordID record_id) const;
 
     virtual KeyValue *get_key(RecordID record_id) const;
+
+    /**
+     * Where to split an overfull node: the candidate nearest the middle of its bytes at which both halves fit.
+     * @param sizes   bytes each entry takes
+     * @param lo      the first candidate (an entry index)
+     * @param hi      one past the last candidate
+     * @param splits  whether splitting at a candidate leaves both halves fitting in a block
+     * @returns       the candidate, or hi if there is none
+     */
+    static size_t split_point(const std::vector<uint> &sizes, size_t lo, size_t hi,
+                              const std::function<bool(size_t)> &splits);
 };
 
 class BTreeStat : public BTreeNode {
@@ -83,6 +135,10 @@ public:
 
     BTreeNode *find(const KeyValue *key, uint depth) const;
 
+    BlockID find_child(const KeyValue *key) const;  // block id of the child whose range holds key
+
+    BTreeNode *edge(bool last, uint depth) const;  // the first (or last) child
+
     Insertion insert(const KeyValue *boundary, BlockID block_id);
 
     virtual void save();
@@ -94,7 +150,12 @@ public:
 protected:
     BlockID first;
     BlockPointers pointers;
-    KeyValues boundaries;
+    KeyValues boundaries;  // separators: possibly truncated keys (see shortest_separator)
+
+    bool fits() const;
+
+    // whether just boundaries [begin, end), their pointers and a first pointer would
+    bool fits(size_t begin, size_t end) const;
 };
 
 class BTreeLeaf : public BTreeNode {
@@ -107,11 +168,57 @@ public:
 
     virtual bool contains(const KeyValue *key);
 
+    /**
+     * Collect the handles of the entries whose keys start with the given prefix.
+     * @param prefix   the leading part of the keys (the entries for it start at or after where it would go)
+     * @param handles  where to add the matching handles
+     * @returns        true if the matches may continue in the next leaf
+     */
+    bool find_prefix(const KeyValue *prefix, Handles *handles) const;
+
+    /**
+     * Collect the handles of the entries in a range of keys.
+     * @param min_key  the least key (entries start at or after where it would go)
+     * @param max_key  entries whose keys start with something greater than this are past the range
+     *                 (nullptr for no upper bound)
+     * @param handles  where to add the handles, in key order
+     * @returns        true if the range may continue in the next leaf
+     */
+    bool find_range(const KeyValue *min_key, const KeyValue *max_key, Handles *handles) const;
+
+    /**
+     * Get the entry with the least (or greatest) key in this leaf.
+     * @param last    whether to get the greatest key rather than the least
+     * @param handle  set to the entry's handle
+     * @returns       false if the leaf has no entries
+     */
+    bool edge(bool last, Handle &handle) const;
+
+    /**
+     * Get the leaf to the right of this one.
+     * @returns  the next leaf (freed by caller), or nullptr if this is the last leaf
+     */
+    BTreeLeaf *next() const;
+
     Insertion insert(const KeyValue *key, Handle handle);
 
+    /**
+     * Remove the entry for a key. Leaves are never merged, so an emptied leaf stays in the chain.
+     * @param key  the entry's full key
+     * @returns    false if there is no such entry
+     */
+    bool del(const KeyValue *key);  // caller saves
+
     virtual void save();
 
 protected:
     BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    std::map<KeyValue, Handle> key_map;  // full keys (the block stores them with their common prefix factored out)
+
+    uint common_prefix() const;
+
+    bool fits() const;
+
+    // whether just the entries [begin, end) would, with their own common prefix
+    static bool fits(std::map<KeyValue, Handle>::const_iterator begin, std::map<KeyValue, Handle>::const_iterator end);
 };
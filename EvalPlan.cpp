@@ -4,7 +4,15 @@
  * @see "Seattle University, CPSC5300, Spring 2020"
  */
 
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <unistd.h>
 #include "EvalPlan.h"
+#include "heap_storage.h"
+#include "btree.h"
 
 
 class Dummy : public DbRelation {
@@ -38,29 +46,117 @@ public:
 
     virtual Handles *select(Handles *current_selection, const ValueDict *where) { return nullptr; }
 
+    virtual Handles *select(const Conjunction &where) { return nullptr; }
+
+    virtual Handles *select(Handles *current_selection, const Conjunction &where) { return nullptr; }
+
     virtual ValueDict *project(Handle handle) { return nullptr; }
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
-EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
+        : type(type), relation(relation), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
+        : type(Project), relation(relation), projection(projection), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *projection, ColumnNames *renames, EvalPlan *relation)
+        : type(Project), relation(relation), projection(projection), renames(renames), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(Conjunction *conjunction, EvalPlan *relation)
+        : type(Select), relation(relation), projection(nullptr), renames(nullptr), select_conjunction(conjunction),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table)
+        : type(TableScan), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(table), indices(), index(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, const DbIndexes &indices)
+        : type(TableScan), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(table), indices(indices),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *key, DbRelation &table)
+        : type(IndexLookup), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(key), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(table), indices(), index(&index) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *min_key, ValueDict *max_key, DbRelation &table)
+        : type(IndexRange), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(min_key), max_key(max_key), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(table), indices(), index(&index) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDicts *keys, DbRelation &table)
+        : type(IndexBatch), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(keys), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(table), indices(), index(&index) {
 }
 
-EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
-                                                                  projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+EvalPlan::EvalPlan(PlanType type, const std::vector<EvalPlan *> &inputs, DbRelation &table)
+        : type(type), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(inputs), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(table), indices(), index(nullptr) {
 }
 
-EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(EvalPlan *probe, EvalPlan *build, ColumnNames *probe_keys, ColumnNames *build_keys)
+        : type(HashJoin), relation(nullptr), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs({probe, build}), probe_keys(probe_keys),
+          build_keys(build_keys), sort_order(nullptr), limit(0), offset(0), aggregation(nullptr), table(Dummy::one()),
+          indices(), index(nullptr) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(SortOrder *sort_order, EvalPlan *relation)
+        : type(Sort), relation(relation), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(sort_order), limit(0), offset(0), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(SortOrder *sort_order, size_t limit, size_t offset, EvalPlan *relation)
+        : type(TopN), relation(relation), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(sort_order), limit(limit), offset(offset), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(size_t limit, size_t offset, EvalPlan *relation)
+        : type(Limit), relation(relation), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(limit), offset(offset), aggregation(nullptr), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(Aggregation *aggregation, EvalPlan *relation)
+        : type(Aggregate), relation(relation), projection(nullptr), renames(nullptr), select_conjunction(nullptr),
+          key(nullptr), max_key(nullptr), keys(nullptr), inputs(), probe_keys(nullptr), build_keys(nullptr),
+          sort_order(nullptr), limit(0), offset(0), aggregation(aggregation), table(Dummy::one()), indices(),
+          index(nullptr) {
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), limit(other->limit), offset(other->offset),
+                                            table(other->table), indices(other->indices), index(other->index) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
@@ -69,55 +165,1915 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         projection = new ColumnNames(*other->projection);
     else
         projection = nullptr;
+    renames = other->renames != nullptr ? new ColumnNames(*other->renames) : nullptr;
     if (other->select_conjunction != nullptr)
-        select_conjunction = new ValueDict(*other->select_conjunction);
+        select_conjunction = new Conjunction(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    key = other->key != nullptr ? new ValueDict(*other->key) : nullptr;
+    max_key = other->max_key != nullptr ? new ValueDict(*other->max_key) : nullptr;
+    if (other->keys != nullptr) {
+        keys = new ValueDicts();
+        for (auto const batch_key: *other->keys)
+            keys->push_back(new ValueDict(*batch_key));
+    } else {
+        keys = nullptr;
+    }
+    for (auto const input: other->inputs)
+        inputs.push_back(new EvalPlan(input));
+    probe_keys = other->probe_keys != nullptr ? new ColumnNames(*other->probe_keys) : nullptr;
+    build_keys = other->build_keys != nullptr ? new ColumnNames(*other->build_keys) : nullptr;
+    sort_order = other->sort_order != nullptr ? new SortOrder(*other->sort_order) : nullptr;
+    aggregation = other->aggregation != nullptr ? new Aggregation(*other->aggregation) : nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
+    delete renames;
     delete select_conjunction;
+    delete key;
+    delete max_key;
+    if (keys != nullptr)
+        for (auto const batch_key: *keys)
+            delete batch_key;
+    delete keys;
+    for (auto const input: inputs)
+        delete input;
+    delete probe_keys;
+    delete build_keys;
+    delete sort_order;
+    delete aggregation;
 }
 
 
 EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+    return use_indices(new EvalPlan(this));
+}
+
+// What a Select's conditions say about the columns of a table, as far as its indices are concerned (ignoring
+// comparisons with values of the wrong type, which never hold anyway).
+struct ColumnConstraints {
+    std::map<Identifier, const Condition *> equalities;
+    std::map<Identifier, const Condition *> in_lists;
+    std::map<Identifier, const Value *> least, greatest;  // the tightest bounds
+    std::map<Identifier, ColumnAttribute::DataType> types;
+
+    ColumnConstraints(const Conjunction &conjunction, const std::map<Identifier, ColumnAttribute::DataType> &types)
+            : equalities(), in_lists(), least(), greatest(), types(types) {
+        for (auto const &condition: conjunction) {
+            const Identifier &column_name = condition.column_name;
+            if (types.find(column_name) == types.end())
+                continue;
+            ColumnAttribute::DataType data_type = types.at(column_name);
+            if (condition.comparison == Condition::EQ) {
+                if (condition.operands[0].data_type == data_type)
+                    equalities[column_name] = &condition;
+                continue;
+            }
+            if (condition.comparison == Condition::IN)
+                in_lists[column_name] = &condition;
+            // the least and greatest values this condition allows
+            const Value *low = nullptr, *high = nullptr;
+            for (uint i = 0; i < condition.operands.size(); i++) {
+                const Value *operand = &condition.operands[i];
+                if (operand->data_type != data_type)
+                    continue;
+                Condition::Comparison comparison = condition.comparison;
+                if ((comparison == Condition::GT || comparison == Condition::GE || comparison == Condition::IN ||
+                     (comparison == Condition::BETWEEN && i == 0)) && (low == nullptr || *operand < *low))
+                    low = operand;
+                if ((comparison == Condition::LT || comparison == Condition::LE || comparison == Condition::IN ||
+                     (comparison == Condition::BETWEEN && i == 1)) && (high == nullptr || *high < *operand))
+                    high = operand;
+            }
+            if (low != nullptr && (least.find(column_name) == least.end() || *least[column_name] < *low))
+                least[column_name] = low;
+            if (high != nullptr && (greatest.find(column_name) == greatest.end() || *high < *greatest[column_name]))
+                greatest[column_name] = high;
+        }
+    }
+};
+
+// How one index could narrow down the rows: its leading key columns given by equalities, followed by a key
+// column with an IN list (a batch of lookups, one per value) or bounds (a range).
+struct IndexSearch {
+    enum Kind {
+        None, Lookup, InList, Range
+    };
+    DbIndex *index;
+    Kind kind;
+    uint given;
+    uint score;  // more key columns beat fewer; an IN list beats a range; a unique full-key lookup beats the rest
+
+    IndexSearch(DbIndex *index, const ColumnConstraints &constraints) : index(index), kind(None), given(0),
+                                                                        score(0) {
+        const ColumnNames &key_columns = index->get_key_columns();
+        uint needed = index->min_lookup_columns();  // 0 if lookup() isn't available
+        while (given < key_columns.size() && constraints.equalities.count(key_columns[given]) > 0)
+            given++;
+        if (needed > 0 && given < key_columns.size() && given + 1 >= needed &&
+            constraints.in_lists.count(key_columns[given]) > 0) {
+            kind = InList;
+            score = 4 * given + 3;
+        } else if (given < key_columns.size() && index->has_range() &&
+                   (constraints.least.count(key_columns[given]) > 0 ||
+                    constraints.greatest.count(key_columns[given]) > 0)) {
+            kind = Range;
+            score = 4 * given + 2;
+        } else if (needed > 0 && given > 0 && given >= needed) {
+            kind = Lookup;
+            score = 4 * given + (index->is_unique() && given == key_columns.size() ? 1 : 0);
+        }
+    }
+
+    // Make the plan for the search, noting the conditions it enforces exactly.
+    EvalPlan *plan(const ColumnConstraints &constraints, DbRelation &table, std::set<const Condition *> &used) const {
+        const ColumnNames &key_columns = index->get_key_columns();
+        ValueDict key;
+        for (uint col_num = 0; col_num < given; col_num++) {
+            const Condition *equality = constraints.equalities.at(key_columns[col_num]);
+            key[key_columns[col_num]] = equality->operands[0];
+            used.insert(equality);
+        }
+        const Identifier &next_column = given < key_columns.size() ? key_columns[given] : Identifier();
+        if (kind == Lookup)
+            return new EvalPlan(*index, new ValueDict(key), table);
+        if (kind == InList) {
+            const Condition *in_list = constraints.in_lists.at(next_column);
+            used.insert(in_list);
+            ValueDicts *keys = new ValueDicts();
+            for (auto const &operand: in_list->operands) {
+                if (operand.data_type != constraints.types.at(next_column))
+                    continue;
+                ValueDict *value_key = new ValueDict(key);
+                (*value_key)[next_column] = operand;
+                keys->push_back(value_key);
+            }
+            return new EvalPlan(*index, keys, table);
+        }
+        // range: the bounds stay in the Select, since they are just narrowed to the least and greatest allowed
+        ValueDict *min_key = nullptr, *max_key = nullptr;
+        if (given > 0 || constraints.least.count(next_column) > 0)
+            min_key = new ValueDict(key);
+        if (given > 0 || constraints.greatest.count(next_column) > 0)
+            max_key = new ValueDict(key);
+        if (constraints.least.count(next_column) > 0)
+            (*min_key)[next_column] = *constraints.least.at(next_column);
+        if (constraints.greatest.count(next_column) > 0)
+            (*max_key)[next_column] = *constraints.greatest.at(next_column);
+        return new EvalPlan(*index, min_key, max_key, table);
+    }
+};
+
+// Replace a Select over a TableScan with searches of the table's indices when the Select's conditions narrow
+// down their keys (see IndexSearch). The best search is used, along with the lookups of any other indices
+// on other leading columns; their handles are intersected (BitmapAnd) and read back in block order, so that
+// each block is visited once. A lone search is also read back in block order (a BitmapOr of one, which also
+// drops the duplicates from an IN list that repeats a value), unless it is a unique lookup of the whole key.
+// The conditions enforced exactly by the searches (equalities and IN lists used for lookups) are dropped from
+// the Select; the rest stay in a Select above the searches.
+// The given plan is used up; the returned plan takes its place.
+EvalPlan *EvalPlan::use_indices(EvalPlan *plan) {
+    if (plan->type == HashJoin) {
+        // look up the build rows for each probe row in an index instead, if there are only a few probe rows
+        plan->inputs[0] = use_indices(plan->inputs[0]);
+        if (plan->inputs[0]->is_small() && (plan->index = join_index(plan)) != nullptr)
+            plan->type = IndexJoin;
+        else
+            plan->inputs[1] = use_indices(plan->inputs[1]);
+        return plan;
+    }
+    if (plan->relation != nullptr)
+        plan->relation = use_indices(plan->relation);
+    if (plan->type == Distinct) {
+        // a lone index search gives its rows in key order rather than block order, if that puts the duplicates
+        // next to each other
+        EvalPlan *parent = plan->relation;
+        if (parent->type != Project && parent->type != ProjectAll)
+            return plan;
+        if (parent->relation->type == Select)
+            parent = parent->relation;
+        EvalPlan *fetch = parent->relation;
+        if (fetch->type != BitmapOr || fetch->inputs.size() != 1)
+            return plan;
+        parent->relation = fetch->inputs[0];
+        ColumnNames column_names;
+        ColumnAttributes column_attributes;
+        plan->relation->get_columns(column_names, column_attributes);
+        if (plan->relation->ordered_by(column_names)) {
+            fetch->inputs.clear();
+            delete fetch;
+        } else {
+            parent->relation = fetch;
+        }
+        return plan;
+    }
+    if (plan->type != Select || plan->relation->type != TableScan || plan->relation->indices.empty())
+        return plan;
+
+    DbRelation &table = plan->relation->table;
+    std::map<Identifier, ColumnAttribute::DataType> types;
+    const ColumnAttributes &column_attributes = table.get_column_attributes();
+    for (uint col_num = 0; col_num < column_attributes.size(); col_num++) {
+        ColumnAttribute ca = column_attributes[col_num];
+        types[table.get_column_names()[col_num]] = ca.get_data_type();
+    }
+    ColumnConstraints constraints(*plan->select_conjunction, types);
+
+    std::vector<IndexSearch> searches;
+    for (auto index: plan->relation->indices)
+        searches.push_back(IndexSearch(index, constraints));
+    const IndexSearch *best = nullptr;
+    for (auto const &search: searches)
+        if (search.kind != IndexSearch::None && (best == nullptr || search.score > best->score))
+            best = &search;
+    if (best == nullptr)
+        return plan;
+
+    std::set<const Condition *> used;
+    std::vector<EvalPlan *> inputs;
+    inputs.push_back(best->plan(constraints, table, used));
+    const Identifier &best_leading = best->index->get_key_columns()[0];
+    for (auto const &search: searches)
+        if (&search != best && (search.kind == IndexSearch::Lookup || search.kind == IndexSearch::InList) &&
+            search.index->get_key_columns()[0] != best_leading)
+            inputs.push_back(search.plan(constraints, table, used));
+    EvalPlan *fetch;
+    if (inputs.size() > 1)
+        fetch = new EvalPlan(BitmapAnd, inputs, table);
+    else if (best->kind == IndexSearch::Lookup && best->index->is_unique() &&
+             best->given == best->index->get_key_columns().size())
+        fetch = inputs[0];
+    else
+        fetch = new EvalPlan(BitmapOr, inputs, table);
+
+    Conjunction *rest = new Conjunction();
+    for (auto const &condition: *plan->select_conjunction)
+        if (used.find(&condition) == used.end())
+            rest->push_back(condition);
+    delete plan->select_conjunction;
+    plan->select_conjunction = rest;
+    delete plan->relation;
+    if (plan->select_conjunction->empty()) {
+        plan->relation = nullptr;
+        delete plan;
+        return fetch;
+    }
+    plan->relation = fetch;
+    return plan;
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+static ValueDict *new_row(Arena *arena) {
+    if (arena == nullptr)
+        return new ValueDict();
+    return arena->make<ValueDict>(ValueDict::allocator_type(arena));
+}
+
+static ValueDicts *new_rows(Arena *arena) {
+    if (arena == nullptr)
+        return new ValueDicts();
+    return arena->make<ValueDicts>(ValueDicts::allocator_type(arena));
+}
+
+size_t EvalPlan::join_memory = 8 * 1024 * 1024;
+size_t EvalPlan::sort_memory = 8 * 1024 * 1024;
+size_t EvalPlan::aggregate_memory = 8 * 1024 * 1024;
+size_t EvalPlan::distinct_memory = 8 * 1024 * 1024;
+
+static const uint SLICE = 1024;  // rows projected at a time by RowSlices
+
+// Roughly how much memory a row takes.
+static size_t row_bytes(const ValueDict *row) {
+    size_t size = sizeof(ValueDict);
+    for (auto const &column: *row) {
+        size += sizeof(ValueDict::value_type) + 4 * sizeof(void *) + column.first.size();
+        if (column.second.data_type == ColumnAttribute::TEXT && column.second.text_size() > Value::INLINE_SZ)
+            size += column.second.text_size();
+    }
+    return size;
+}
+
+// The build side of a hash join: the build rows by key, held within EvalPlan::join_memory.
+class HashJoinTable {
+public:
+    HashJoinTable(const ColumnNames &probe_keys, const ColumnNames &build_keys, Arena *arena)
+            : probe_keys(probe_keys), build_keys(build_keys), arena(arena), rows(), bytes(0) {}
+
+    ~HashJoinTable() { clear(); }
+
+    // Take a build row; false if the rows now take up more than the budget.
+    bool add(ValueDict *row) {
+        std::string key;
+        join_key(row, build_keys, key);
+        bytes += key.size() + row_bytes(row);
+        rows.insert(std::make_pair(key, row));
+        return bytes <= EvalPlan::join_memory;
+    }
+
+    // Hand over all the build rows (freed by caller).
+    ValueDicts *release() {
+        ValueDicts *released = new ValueDicts();
+        for (auto const &entry: rows)
+            released->push_back(entry.second);
+        rows.clear();
+        bytes = 0;
+        return released;
+    }
+
+    // Add a row to joined for each build row with the same key as the probe row.
+    void probe(const ValueDict *row, ValueDicts &joined) const {
+        std::string key;
+        join_key(row, probe_keys, key);
+        auto matches = rows.equal_range(key);
+        for (auto match = matches.first; match != matches.second; match++) {
+            ValueDict *result = new_row(arena);
+            result->insert(row->begin(), row->end());
+            result->insert(match->second->begin(), match->second->end());
+            joined.push_back(result);
+        }
+    }
+
+    void clear() {
+        for (auto const &entry: rows)
+            delete entry.second;
+        rows.clear();
+        bytes = 0;
+    }
+
+    // The values of the key columns, each tagged with its data type, so equal keys get equal strings.
+    static void join_key(const ValueDict *row, const ColumnNames &key_columns, std::string &key) {
+        for (auto const &column_name: key_columns) {
+            const Value &value = row->at(column_name);
+            key.push_back((char) value.data_type);
+            if (value.data_type == ColumnAttribute::TEXT) {
+                uint16_t size = value.text_size();
+                key.append((const char *) &size, sizeof(size));
+                key.append(value.text_data(), size);
+            } else {
+                key.append((const char *) &value.n, sizeof(value.n));
+            }
+        }
+    }
+
+protected:
+    const ColumnNames &probe_keys;
+    const ColumnNames &build_keys;
+    Arena *arena;  // where to make the joined rows
+    std::unordered_multimap<std::string, ValueDict *> rows;
+    size_t bytes;  // roughly how much memory the rows take
+
+};
+
+static void spill_row(const ValueDict *row, const ColumnNames &key_columns, std::vector<HeapTable *> &partitions) {
+    std::string key;
+    HashJoinTable::join_key(row, key_columns, key);
+    partitions[std::hash<std::string>()(key) % partitions.size()]->insert(row);
+}
+
+// Make count spill partitions (temporary tables for the rows of the given plan), one for each hash bucket.
+static void make_partitions(const EvalPlan *side, const char *kind, uint count, std::vector<HeapTable *> &partitions) {
+    static uint spills = 0;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    side->get_columns(column_names, column_attributes);
+    Identifier prefix = std::string("__") + kind + "_" + std::to_string(getpid()) + "_" +
+                        std::to_string(spills++) + "_";
+    for (uint i = 0; i < count; i++) {
+        HeapTable *partition = new HeapTable(prefix + std::to_string(i), column_names, column_attributes);
+        partitions.push_back(partition);
+        partition->create();
+    }
+}
+
+// Make a spill partition for each hash bucket and move the given rows (and their list) into them.
+static void spill(const EvalPlan *side, ValueDicts *rows, const ColumnNames &key_columns,
+                  std::vector<HeapTable *> &partitions) {
+    make_partitions(side, "join", EvalPlan::JOIN_PARTITIONS, partitions);
+    for (auto const row: *rows) {
+        spill_row(row, key_columns, partitions);
+        delete row;
+    }
+    delete rows;
+}
+
+// Read back all the rows of a spill partition (freed by caller).
+static ValueDicts *unspill(HeapTable *partition) {
+    Handles *handles = partition->select();
+    ValueDicts *rows = partition->project(handles);
+    delete handles;
+    return rows;
+}
+
+static void drop_partitions(std::vector<HeapTable *> &partitions) {
+    for (auto const partition: partitions) {
+        partition->drop();
+        delete partition;
+    }
+    partitions.clear();
+}
+
+// The rows of a plan a slice at a time: a projection of a table is projected SLICE handles at a time (so the
+// caller need not hold all of its rows at once); any other plan is evaluated whole, as the one slice.
+class RowSlices {
+public:
+    explicit RowSlices(EvalPlan *plan) : plan(plan), pipeline(nullptr, nullptr), start(0), done(false) {
+        sliced = (plan->type == EvalPlan::ProjectAll || plan->type == EvalPlan::Project) &&
+                 !plan->relation->has_rows();
+        if (sliced)
+            pipeline = plan->relation->pipeline();
+    }
+
+    ~RowSlices() { delete pipeline.second; }
+
+    // The next slice of rows (freed by caller), or nullptr once they have all been given.
+    ValueDicts *next() {
+        if (!sliced) {
+            if (done)
+                return nullptr;
+            done = true;
+            return plan->evaluate();
+        }
+        if (start >= pipeline.second->size())
+            return nullptr;
+        size_t end = std::min(start + SLICE, pipeline.second->size());
+        Handles slice(pipeline.second->begin() + start, pipeline.second->begin() + end);
+        start = end;
+        return plan->project(pipeline.first, &slice, nullptr);
+    }
+
+protected:
+    EvalPlan *plan;
+    bool sliced;
+    EvalPipeline pipeline;
+    size_t start;
+    bool done;
+};
+
+ValueDicts *EvalPlan::evaluate(Arena *arena) {
+    if (this->type == HashJoin)
+        return hash_join(arena);
+    if (this->type == IndexJoin)
+        return index_join(arena);
+    if (this->type == Sort)
+        return sort(arena);
+    if (this->type == TopN)
+        return top_n(arena);
+    if (this->type == Limit)
+        return limit_rows(arena);
+    if (this->type == Aggregate)
+        return aggregate(arena);
+    if (this->type == Distinct)
+        return distinct(arena);
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
+    if (this->relation->has_rows()) {
+        ValueDicts *joined = this->relation->evaluate();
+        if (this->type == ProjectAll && arena == nullptr)
+            return joined;
+        ValueDicts *ret = new_rows(arena);
+        ret->reserve(joined->size());
+        for (auto const row: *joined) {
+            ValueDict *result = new_row(arena);
+            if (this->type == ProjectAll)
+                result->insert(row->begin(), row->end());
+            else
+                for (auto const &column_name: *this->projection)
+                    (*result)[column_name] = row->at(column_name);
+            ret->push_back(result);
+            delete row;
+        }
+        delete joined;
+        return ret;
+    }
+
     EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+    ValueDicts *ret;
+    try {
+        ret = project(pipeline.first, pipeline.second, arena);
+    } catch (...) {
+        delete pipeline.second;
+        throw;
+    }
+    delete pipeline.second;
     return ret;
 }
 
+// Project the rows for the given handles (this is a ProjectAll or Project), under their new names if renamed.
+ValueDicts *EvalPlan::project(DbRelation *table, Handles *handles, Arena *arena) {
+    ValueDicts *rows;
+    if (this->type == ProjectAll)
+        rows = table->project(handles, arena);
+    else
+        rows = table->project(handles, this->projection, arena);
+    if (this->renames == nullptr)
+        return rows;
+    for (auto &row: *rows) {
+        ValueDict *renamed = new_row(arena);
+        for (uint i = 0; i < this->projection->size(); i++)
+            (*renamed)[(*this->renames)[i]] = row->at((*this->projection)[i]);
+        if (arena == nullptr)
+            delete row;
+        row = renamed;
+    }
+    return rows;
+}
+
+void EvalPlan::get_columns(ColumnNames &column_names, ColumnAttributes &column_attributes) const {
+    if (is_join()) {
+        this->inputs[0]->get_columns(column_names, column_attributes);
+        this->inputs[1]->get_columns(column_names, column_attributes);
+        return;
+    }
+    if (this->type == Sort || this->type == TopN || this->type == Limit || this->type == Distinct) {
+        this->relation->get_columns(column_names, column_attributes);
+        return;
+    }
+    if (this->type == Aggregate) {
+        ColumnNames input_names;
+        ColumnAttributes input_attributes;
+        this->relation->get_columns(input_names, input_attributes);
+        auto input_attribute = [&](const Identifier &column_name) {
+            auto found = std::find(input_names.begin(), input_names.end(), column_name);
+            if (found == input_names.end())
+                throw DbRelationError("unknown column " + column_name);
+            return input_attributes[found - input_names.begin()];
+        };
+        for (auto const &column_name: this->aggregation->group_by) {
+            column_names.push_back(column_name);
+            column_attributes.push_back(input_attribute(column_name));
+        }
+        for (auto const &function: this->aggregation->functions) {
+            column_names.push_back(function.name);
+            if (function.function == AggregateFunction::MIN || function.function == AggregateFunction::MAX)
+                column_attributes.push_back(input_attribute(function.column_name));
+            else
+                column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        }
+        return;
+    }
+    if (this->type != ProjectAll && this->type != Project)
+        throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+    ColumnNames all_names;
+    ColumnAttributes all_attributes;
+    if (this->relation->has_rows()) {
+        this->relation->get_columns(all_names, all_attributes);
+    } else {
+        const EvalPlan *source = this->relation;
+        while (source->relation != nullptr)
+            source = source->relation;
+        all_names = source->table.get_column_names();
+        all_attributes = source->table.get_column_attributes();
+    }
+    if (this->type == ProjectAll) {
+        column_names.insert(column_names.end(), all_names.begin(), all_names.end());
+        column_attributes.insert(column_attributes.end(), all_attributes.begin(), all_attributes.end());
+        return;
+    }
+    for (uint i = 0; i < this->projection->size(); i++) {
+        const Identifier &column_name = (*this->projection)[i];
+        auto found = std::find(all_names.begin(), all_names.end(), column_name);
+        if (found == all_names.end())
+            throw DbRelationError("unknown column " + column_name);
+        column_names.push_back(this->renames != nullptr ? (*this->renames)[i] : column_name);
+        column_attributes.push_back(all_attributes[found - all_names.begin()]);
+    }
+}
+
+// A hash join: the build rows are put in a hash table by their key columns, then each probe row is joined with
+// the build rows whose keys equal its own. Both sides are read a slice at a time. Once the build rows take up more
+// than join_memory, all of them (and then each slice of the probe rows) are spilled by key hash to partitions on
+// disk instead (a grace hash join); each pair of partitions is then joined in memory the same way. The joined rows
+// have all the columns of the probe row and of the build row.
+ValueDicts *EvalPlan::hash_join(Arena *arena) {
+    HashJoinTable join_table(*this->probe_keys, *this->build_keys, arena);
+    std::vector<HeapTable *> build_partitions, probe_partitions;
+    ValueDicts *joined = new_rows(arena);
+    ValueDicts *rows = nullptr;  // the rows being worked on (each set to nullptr once it is let go)
+    try {
+        // build
+        EvalPlan *build = this->inputs[1];
+        RowSlices build_slices(build);
+        while ((rows = build_slices.next()) != nullptr) {
+            for (auto &row: *rows) {
+                if (!build_partitions.empty()) {
+                    spill_row(row, *this->build_keys, build_partitions);
+                    delete row;
+                } else if (!join_table.add(row)) {
+                    spill(build, join_table.release(), *this->build_keys, build_partitions);
+                }
+                row = nullptr;
+            }
+            delete rows;
+            rows = nullptr;
+        }
+
+        // probe
+        EvalPlan *probe = this->inputs[0];
+        if (!build_partitions.empty())
+            make_partitions(probe, "join", JOIN_PARTITIONS, probe_partitions);
+        RowSlices probe_slices(probe);
+        while ((rows = probe_slices.next()) != nullptr) {
+            for (auto &row: *rows) {
+                if (probe_partitions.empty())
+                    join_table.probe(row, *joined);
+                else
+                    spill_row(row, *this->probe_keys, probe_partitions);
+                delete row;
+                row = nullptr;
+            }
+            delete rows;
+            rows = nullptr;
+        }
+
+        for (uint i = 0; i < probe_partitions.size(); i++) {
+            rows = unspill(build_partitions[i]);
+            for (auto &row: *rows) {
+                join_table.add(row);  // a partition that is still too big just goes over the budget
+                row = nullptr;
+            }
+            delete rows;
+            rows = nullptr;
+            rows = unspill(probe_partitions[i]);
+            for (auto &row: *rows) {
+                join_table.probe(row, *joined);
+                delete row;
+                row = nullptr;
+            }
+            delete rows;
+            rows = nullptr;
+            join_table.clear();
+        }
+    } catch (...) {
+        if (rows != nullptr) {
+            for (auto const row: *rows)
+                delete row;
+            delete rows;
+        }
+        drop_partitions(build_partitions);
+        drop_partitions(probe_partitions);
+        if (arena == nullptr) {
+            for (auto const row: *joined)
+                delete row;
+            delete joined;
+        }
+        throw;
+    }
+    drop_partitions(build_partitions);
+    drop_partitions(probe_partitions);
+    return joined;
+}
+
+// An index nested-loop join: the build rows for each probe row are looked up in an index of the build table on
+// (the leading columns of) the build keys, a batch of probe rows at a time. The build side is a projection of the
+// table, perhaps with conditions, which are checked on the rows looked up.
+ValueDicts *EvalPlan::index_join(Arena *arena) {
+    EvalPlan *build = this->inputs[1];
+    EvalPlan *source = build->relation;
+    const Conjunction *where = nullptr;
+    if (source->type == Select) {
+        where = source->select_conjunction;
+        source = source->relation;
+    }
+    DbRelation &table = source->table;
+
+    // the build table's own names for the build keys, and the probe keys that go with the index's key columns
+    ColumnNames build_columns;
+    const ColumnNames &build_names = build->renames != nullptr ? *build->renames : *build->projection;
+    for (auto const &build_key: *this->build_keys)
+        build_columns.push_back((*build->projection)[std::find(build_names.begin(), build_names.end(), build_key) -
+                                                     build_names.begin()]);
+    std::map<Identifier, ColumnAttribute::DataType> types;
+    const ColumnAttributes column_attributes = table.get_column_attributes();
+    for (uint col_num = 0; col_num < column_attributes.size(); col_num++) {
+        ColumnAttribute ca = column_attributes[col_num];
+        types[table.get_column_names()[col_num]] = ca.get_data_type();
+    }
+    ColumnNames index_columns, lookup_keys;
+    for (auto const &key_column: this->index->get_key_columns()) {
+        auto found = std::find(build_columns.begin(), build_columns.end(), key_column);
+        if (found == build_columns.end())
+            break;
+        index_columns.push_back(key_column);
+        lookup_keys.push_back((*this->probe_keys)[found - build_columns.begin()]);
+    }
+
+    ValueDicts *probe_rows = this->inputs[0]->evaluate();
+    ValueDicts *joined = new_rows(arena);
+    ValueDicts keys;  // the batch's, freed once it's joined (or on the way out)
+    std::vector<Handles *> results;
+    ValueDicts *rows = nullptr;
+    try {
+        this->index->open();
+        for (uint start = 0; start < probe_rows->size(); start += JOIN_BATCH) {
+            uint end = std::min(start + JOIN_BATCH, (uint) probe_rows->size());
+            std::vector<const ValueDict *> probes;
+            for (uint i = start; i < end; i++) {
+                const ValueDict *probe = (*probe_rows)[i];
+                ValueDict *key = new ValueDict();
+                keys.push_back(key);
+                bool typed = true;
+                for (uint j = 0; j < index_columns.size(); j++) {
+                    const Value &value = probe->at(lookup_keys[j]);
+                    (*key)[index_columns[j]] = value;
+                    typed = typed && value.data_type == types[index_columns[j]];
+                }
+                if (!typed) {
+                    keys.pop_back();
+                    delete key;  // a key of the wrong type matches nothing
+                    continue;
+                }
+                probes.push_back(probe);
+            }
+            results = this->index->lookup_batch(keys);
+            for (uint i = 0; i < results.size(); i++) {
+                if (where != nullptr) {
+                    Handles *selected = table.select(results[i], *where);
+                    delete results[i];
+                    results[i] = selected;
+                }
+                rows = build->project(&table, results[i], nullptr);
+                for (auto const row: *rows) {
+                    bool match = true;
+                    for (uint k = 0; k < this->probe_keys->size() && match; k++)
+                        match = probes[i]->at((*this->probe_keys)[k]) == row->at((*this->build_keys)[k]);
+                    if (match) {
+                        ValueDict *result = new_row(arena);
+                        result->insert(probes[i]->begin(), probes[i]->end());
+                        result->insert(row->begin(), row->end());
+                        joined->push_back(result);
+                    }
+                }
+                for (auto const row: *rows)
+                    delete row;
+                delete rows;
+                rows = nullptr;
+            }
+            for (auto const handles: results)
+                delete handles;
+            results.clear();
+            for (auto const key: keys)
+                delete key;
+            keys.clear();
+        }
+    } catch (...) {
+        if (rows != nullptr) {
+            for (auto const row: *rows)
+                delete row;
+            delete rows;
+        }
+        for (auto const handles: results)
+            delete handles;
+        for (auto const key: keys)
+            delete key;
+        for (auto const row: *probe_rows)
+            delete row;
+        delete probe_rows;
+        if (arena == nullptr) {
+            for (auto const row: *joined)
+                delete row;
+            delete joined;
+        }
+        throw;
+    }
+    for (auto const row: *probe_rows)
+        delete row;
+    delete probe_rows;
+    return joined;
+}
+
+// Orders rows by a SortOrder.
+class RowLess {
+public:
+    explicit RowLess(const SortOrder &sort_order) : sort_order(sort_order) {}
+
+    bool operator()(const ValueDict *a, const ValueDict *b) const {
+        for (auto const &column: sort_order) {
+            const Value &x = a->at(column.first);
+            const Value &y = b->at(column.first);
+            if (x < y)
+                return !column.second;
+            if (y < x)
+                return column.second;
+        }
+        return false;
+    }
+
+protected:
+    const SortOrder &sort_order;
+};
+
+// A sorted run spilled to a temporary table, read back SLICE rows at a time in the order they were written.
+class SortRun {
+public:
+    SortRun(HeapTable *table) : table(table), handles(table->select()), start(0), rows(nullptr), at(0) {
+        fill();
+    }
+
+    ~SortRun() {
+        discard();
+        delete handles;
+        table->drop();
+        delete table;
+    }
+
+    // The next row of the run, or nullptr if there are no more.
+    const ValueDict *peek() const { return rows == nullptr ? nullptr : (*rows)[at]; }
+
+    // Hand over the next row (freed by caller).
+    ValueDict *take() {
+        ValueDict *row = (*rows)[at];
+        (*rows)[at++] = nullptr;
+        if (at == rows->size())
+            fill();
+        return row;
+    }
+
+protected:
+    HeapTable *table;
+    Handles *handles;
+    size_t start;  // of the next slice of handles
+    ValueDicts *rows;  // the current slice
+    size_t at;  // the next row in the current slice
+
+    void fill() {
+        discard();
+        if (start >= handles->size())
+            return;
+        size_t end = std::min(start + SLICE, handles->size());
+        Handles slice(handles->begin() + start, handles->begin() + end);
+        start = end;
+        rows = table->project(&slice);
+        at = 0;
+    }
+
+    void discard() {
+        if (rows == nullptr)
+            return;
+        for (auto const row: *rows)
+            delete row;
+        delete rows;
+        rows = nullptr;
+    }
+};
+
+// Add a row to the results (moving it into the arena, if given).
+static void keep_row(ValueDict *row, ValueDicts &results, Arena *arena) {
+    if (arena == nullptr) {
+        results.push_back(row);
+        return;
+    }
+    ValueDict *copy = new_row(arena);
+    copy->insert(row->begin(), row->end());
+    results.push_back(copy);
+    delete row;
+}
+
+// Sort the given rows and move them into a new run (the list is left empty).
+static SortRun *spill_run(const EvalPlan *plan, ValueDicts &rows, const RowLess &less) {
+    static uint spills = 0;
+    std::stable_sort(rows.begin(), rows.end(), less);
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    plan->get_columns(column_names, column_attributes);
+    HeapTable *table = new HeapTable("__sort_" + std::to_string(getpid()) + "_" + std::to_string(spills++),
+                                     column_names, column_attributes);
+    table->create();
+    try {
+        for (auto const row: rows)
+            table->insert(row);
+    } catch (...) {
+        table->drop();
+        delete table;
+        throw;
+    }
+    for (auto const row: rows)
+        delete row;
+    rows.clear();
+    return new SortRun(table);
+}
+
+// Merges sorted runs with a loser tree. Each internal node holds the run that lost the match played there, and
+// node 0 holds the overall winner, so once the winner's row is taken only the matches on the path from its leaf
+// to the root are replayed. An exhausted run loses to every other; ties go to the earlier run, so the merge is
+// stable.
+class RunMerge {
+public:
+    RunMerge(const std::vector<SortRun *> &runs, const RowLess &less)
+            : runs(runs), less(less), k((uint) runs.size()), tree(runs.size(), (uint) runs.size()) {
+        // start with every node holding a sentinel that beats all the runs, and let each run play its way up
+        for (uint run = 0; run < k; run++)
+            replay(run);
+    }
+
+    // The run with the least next row (it has no rows if none of them do).
+    SortRun *winner() const { return runs[tree[0]]; }
+
+    // Find the new winner after the winner's row has been taken.
+    void next() { replay(tree[0]); }
+
+protected:
+    const std::vector<SortRun *> &runs;
+    const RowLess &less;
+    uint k;
+    std::vector<uint> tree;  // run numbers; k is the sentinel
+
+    // Whether run a wins its match against run b.
+    bool beats(uint a, uint b) const {
+        if (a == k || b == k)
+            return a == k && b != k;
+        const ValueDict *x = runs[a]->peek();
+        const ValueDict *y = runs[b]->peek();
+        if (x == nullptr || y == nullptr)
+            return x != nullptr;
+        if (less(x, y))
+            return true;
+        if (less(y, x))
+            return false;
+        return a < b;
+    }
+
+    void replay(uint run) {
+        uint winner = run;
+        for (uint node = (run + k) / 2; node > 0; node /= 2)
+            if (beats(tree[node], winner))
+                std::swap(tree[node], winner);
+        tree[0] = winner;
+    }
+};
+
+// Sort the rows of the relation (stably). Rows are gathered until they take up more than sort_memory, then
+// sorted and spilled as a run to a temporary table, and the gathering starts over; an external merge of the runs
+// then gives the sorted rows. If the rows all fit, they are just sorted in memory.
+ValueDicts *EvalPlan::sort(Arena *arena) {
+    RowLess less(*this->sort_order);
+    std::vector<SortRun *> runs;
+    ValueDicts rows;
+    ValueDicts *sorted = nullptr;
+    try {
+        RowSlices slices(this->relation);
+        ValueDicts *slice;
+        size_t bytes = 0;
+        while ((slice = slices.next()) != nullptr) {
+            rows.insert(rows.end(), slice->begin(), slice->end());
+            for (auto const row: *slice)
+                bytes += row_bytes(row) + sizeof(ValueDict *);
+            delete slice;
+            if (bytes > sort_memory) {
+                runs.push_back(spill_run(this->relation, rows, less));
+                bytes = 0;
+            }
+        }
+
+        if (runs.empty()) {
+            std::stable_sort(rows.begin(), rows.end(), less);
+            sorted = new_rows(arena);
+            sorted->reserve(rows.size());
+            for (auto &row: rows) {
+                keep_row(row, *sorted, arena);
+                row = nullptr;
+            }
+            return sorted;
+        }
+
+        if (!rows.empty())
+            runs.push_back(spill_run(this->relation, rows, less));
+        sorted = new_rows(arena);
+        RunMerge merge(runs, less);
+        for (SortRun *run = merge.winner(); run->peek() != nullptr; run = merge.winner()) {
+            keep_row(run->take(), *sorted, arena);
+            merge.next();
+        }
+    } catch (...) {
+        for (auto const row: rows)
+            delete row;
+        for (auto const run: runs)
+            delete run;
+        if (sorted != nullptr && arena == nullptr) {
+            for (auto const row: *sorted)
+                delete row;
+            delete sorted;
+        }
+        throw;
+    }
+    for (auto const run: runs)
+        delete run;
+    return sorted;
+}
+
+// The first offset + limit rows of the relation in sort order (stably), less the first offset of them. The rows
+// stream through a heap that holds the best of them so far, with the last of those on top, so only that many
+// rows are ever held and each new row is compared against the top to see if it gets in.
+ValueDicts *EvalPlan::top_n(Arena *arena) {
+    size_t wanted = this->offset + this->limit;
+    RowLess less(*this->sort_order);
+    typedef std::pair<ValueDict *, size_t> Ranked;  // a row and its position in the input
+    auto before = [&less](const Ranked &a, const Ranked &b) {
+        return less(a.first, b.first) || (!less(b.first, a.first) && a.second < b.second);
+    };
+    std::vector<Ranked> heap;
+    try {
+        RowSlices slices(this->relation);
+        ValueDicts *slice;
+        size_t position = 0;
+        while ((slice = slices.next()) != nullptr) {
+            for (auto const row: *slice) {
+                Ranked ranked(row, position++);
+                if (heap.size() < wanted) {
+                    heap.push_back(ranked);
+                    std::push_heap(heap.begin(), heap.end(), before);
+                } else if (wanted > 0 && before(ranked, heap.front())) {
+                    std::pop_heap(heap.begin(), heap.end(), before);
+                    delete heap.back().first;
+                    heap.back() = ranked;
+                    std::push_heap(heap.begin(), heap.end(), before);
+                } else {
+                    delete row;
+                }
+            }
+            delete slice;
+        }
+    } catch (...) {
+        for (auto const &ranked: heap)
+            delete ranked.first;
+        throw;
+    }
+    std::sort_heap(heap.begin(), heap.end(), before);
+    ValueDicts *rows = new_rows(arena);
+    for (size_t i = 0; i < heap.size(); i++) {
+        if (i < this->offset)
+            delete heap[i].first;
+        else
+            keep_row(heap[i].first, *rows, arena);
+    }
+    return rows;
+}
+
+// The rows of the relation after the first offset, up to limit of them. A projection of a table scan (perhaps
+// with conditions) stops the scan once it has found enough rows; otherwise rows are read a slice at a time
+// until there are enough.
+ValueDicts *EvalPlan::limit_rows(Arena *arena) {
+    size_t wanted = this->limit == NO_LIMIT ? NO_LIMIT : this->offset + this->limit;
+    if ((this->relation->type == ProjectAll || this->relation->type == Project) && wanted != NO_LIMIT) {
+        EvalPlan *source = this->relation->relation;
+        Conjunction where;
+        if (source->type == Select) {
+            where = *source->select_conjunction;
+            source = source->relation;
+        }
+        if (source->type == TableScan) {
+            Handles *handles = source->table.select(where, wanted);
+            handles->erase(handles->begin(), handles->begin() + std::min(this->offset, handles->size()));
+            ValueDicts *rows = this->relation->project(&source->table, handles, arena);
+            delete handles;
+            return rows;
+        }
+    }
+
+    ValueDicts *rows = new_rows(arena);
+    try {
+        RowSlices slices(this->relation);
+        ValueDicts *slice;
+        size_t position = 0;
+        while (position < wanted && (slice = slices.next()) != nullptr) {
+            for (auto const row: *slice) {
+                if (position >= this->offset && position < wanted)
+                    keep_row(row, *rows, arena);
+                else
+                    delete row;
+                position++;
+            }
+            delete slice;
+        }
+    } catch (...) {
+        if (arena == nullptr) {
+            for (auto const row: *rows)
+                delete row;
+            delete rows;
+        }
+        throw;
+    }
+    return rows;
+}
+
+// The groups of an Aggregate and their running values, in an open-addressing hash table. The slots hold just a
+// hash and a group number and are probed linearly; the groups' keys, group-by values and accumulators are kept in
+// arrays by group number (a group's accumulators side by side), so a probe reads only the small slots until the
+// hashes match, and folding a row in touches one stretch of accumulators.
+class GroupTable {
+public:
+    struct Accumulator {
+        int64_t count;  // rows folded in
+        int64_t sum;  // for SUM and AVG
+        Value extreme;  // for MIN and MAX
+    };
+
+    GroupTable(const Aggregation &aggregation, const std::vector<ColumnAttribute::DataType> &types, size_t budget)
+            : aggregation(aggregation), types(types), budget(budget), slots(MIN_SLOTS), shift(64 - MIN_SHIFT), keys(),
+              group_values(), accumulators(), bytes(0) {}
+
+    ~GroupTable() {
+        for (auto const values: group_values)
+            delete values;
+    }
+
+    // Fold a row into its group; false (leaving the row out) if it would start a new group once the groups take
+    // up more than the budget.
+    bool add(const ValueDict *row) {
+        std::string key;
+        HashJoinTable::join_key(row, aggregation.group_by, key);
+        size_t hash = std::hash<std::string>()(key);
+        size_t slot = find(key, hash);
+        uint group;
+        if (slots[slot].group != 0) {
+            group = slots[slot].group - 1;
+        } else {
+            if (bytes > budget)
+                return false;
+            group = start_group(key, hash, slot, row);
+        }
+        Accumulator *accumulator = &accumulators[group * aggregation.functions.size()];
+        for (auto const &function: aggregation.functions) {
+            accumulator->count++;
+            if (function.function != AggregateFunction::COUNT) {
+                const Value &value = row->at(function.column_name);
+                if (function.function == AggregateFunction::SUM || function.function == AggregateFunction::AVG)
+                    accumulator->sum += value.n;
+                else if (accumulator->count == 1 ||
+                         (function.function == AggregateFunction::MIN ? value < accumulator->extreme
+                                                                       : accumulator->extreme < value))
+                    accumulator->extreme = value;
+            }
+            accumulator++;
+        }
+        return true;
+    }
+
+    // Add a row to results for each group (and for no rows at all, if there are no group-by columns).
+    void results(ValueDicts &rows, Arena *arena) {
+        if (keys.empty() && aggregation.group_by.empty()) {
+            ValueDict none;
+            start_group(std::string(), std::hash<std::string>()(std::string()), 0, &none);
+        }
+        uint function_count = (uint) aggregation.functions.size();
+        for (uint group = 0; group < keys.size(); group++) {
+            ValueDict *row = new_row(arena);
+            row->insert(group_values[group]->begin(), group_values[group]->end());
+            for (uint i = 0; i < function_count; i++)
+                (*row)[aggregation.functions[i].name] = result(aggregation.functions[i], types[i],
+                                                               accumulators[group * function_count + i]);
+            rows.push_back(row);
+        }
+    }
+
+    // The value of a function for a group. (There are no NULLs, so over no rows SUM, AVG, MIN and MAX are
+    // zero, or the empty string, or false.)
+    static Value result(const AggregateFunction &function, ColumnAttribute::DataType data_type,
+                        const Accumulator &accumulator) {
+        int64_t n;
+        switch (function.function) {
+            case AggregateFunction::COUNT:
+                n = accumulator.count;
+                break;
+            case AggregateFunction::SUM:
+                n = accumulator.sum;
+                break;
+            case AggregateFunction::AVG:
+                n = accumulator.count == 0 ? 0 : accumulator.sum / accumulator.count;
+                break;
+            default:
+                if (accumulator.count > 0)
+                    return accumulator.extreme;
+                if (data_type == ColumnAttribute::TEXT)
+                    return Value("");
+                Value zero;
+                zero.data_type = data_type;
+                return zero;
+        }
+        if (n < INT32_MIN || n > INT32_MAX)
+            throw DbRelationError(function.name + " is out of range");
+        return Value((int32_t) n);
+    }
+
+protected:
+    struct Slot {
+        size_t hash;
+        uint group;  // the group's number plus one (0 for an empty slot)
+    };
+    static const uint MIN_SHIFT = 6;
+    static const size_t MIN_SLOTS = 1 << MIN_SHIFT;
+    const Aggregation &aggregation;
+    const std::vector<ColumnAttribute::DataType> &types;  // by function: the data type of its column
+    size_t budget;
+    std::vector<Slot> slots;  // a power of two of them, at most half full
+    uint shift;  // 64 less the log of the number of slots
+    std::vector<std::string> keys;  // by group
+    std::vector<ValueDict *> group_values;  // by group
+    std::vector<Accumulator> accumulators;  // by group, then by function
+    size_t bytes;  // roughly how much memory the groups take
+
+    // Where the given key is, or the empty slot where it would go. The hash is spread by a multiplicative
+    // (Fibonacci) hash, since the keys of a spill partition all have the same hash modulo the partition count.
+    size_t find(const std::string &key, size_t hash) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = (size_t) (((uint64_t) hash * 0x9E3779B97F4A7C15ull) >> shift);
+        while (slots[slot].group != 0 && (slots[slot].hash != hash || keys[slots[slot].group - 1] != key))
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    uint start_group(const std::string &key, size_t hash, size_t slot, const ValueDict *row) {
+        uint group = (uint) keys.size();
+        slots[slot].hash = hash;
+        slots[slot].group = group + 1;
+        keys.push_back(key);
+        ValueDict *values = new ValueDict();
+        for (auto const &column_name: aggregation.group_by)
+            (*values)[column_name] = row->at(column_name);
+        group_values.push_back(values);
+        accumulators.resize(accumulators.size() + aggregation.functions.size(), Accumulator{0, 0, Value()});
+        bytes += key.size() + row_bytes(values) + aggregation.functions.size() * sizeof(Accumulator) +
+                 2 * sizeof(Slot);
+        if (2 * keys.size() > slots.size())
+            grow();
+        return group;
+    }
+
+    void grow() {
+        std::vector<Slot> old(2 * slots.size());
+        old.swap(slots);
+        shift--;
+        for (auto const &entry: old) {
+            if (entry.group == 0)
+                continue;
+            size_t slot = (size_t) (((uint64_t) entry.hash * 0x9E3779B97F4A7C15ull) >> shift);
+            while (slots[slot].group != 0)
+                slot = (slot + 1) & (slots.size() - 1);
+            slots[slot] = entry;
+        }
+    }
+};
+
+// Group the rows of the relation and compute the aggregate functions for each group. Each row is folded into its
+// group's running values as it streams past, so only the groups are held. Once the groups take up more than
+// aggregate_memory, the rows of any further groups are spilled by the hash of their group-by values to
+// partitions on disk (the groups already in memory carry on); each partition is then aggregated on its own.
+ValueDicts *EvalPlan::aggregate(Arena *arena) {
+    ColumnNames input_names;
+    ColumnAttributes input_attributes;
+    this->relation->get_columns(input_names, input_attributes);
+    std::vector<ColumnAttribute::DataType> types;
+    for (auto const &function: this->aggregation->functions) {
+        ColumnAttribute::DataType data_type = ColumnAttribute::INT;
+        if (function.function != AggregateFunction::COUNT) {
+            auto found = std::find(input_names.begin(), input_names.end(), function.column_name);
+            if (found == input_names.end())
+                throw DbRelationError("unknown column " + function.column_name);
+            ColumnAttribute ca = input_attributes[found - input_names.begin()];
+            data_type = ca.get_data_type();
+        }
+        if ((function.function == AggregateFunction::SUM || function.function == AggregateFunction::AVG) &&
+            data_type != ColumnAttribute::INT)
+            throw DbRelationError(function.name + " needs an INT column");
+        types.push_back(data_type);
+    }
+
+    std::vector<HeapTable *> partitions;
+    ValueDicts *results = new_rows(arena);
+    try {
+        if (aggregate_without_rows(types, *results, arena))
+            return results;
+        GroupTable groups(*this->aggregation, types, aggregate_memory);
+        RowSlices slices(this->relation);
+        ValueDicts *slice;
+        while ((slice = slices.next()) != nullptr) {
+            for (auto const row: *slice) {
+                if (!groups.add(row)) {
+                    if (partitions.empty())
+                        make_partitions(this->relation, "aggregate", AGGREGATE_PARTITIONS, partitions);
+                    spill_row(row, this->aggregation->group_by, partitions);
+                }
+                delete row;
+            }
+            delete slice;
+        }
+        groups.results(*results, arena);
+        for (auto const partition: partitions) {
+            GroupTable partition_groups(*this->aggregation, types, (size_t) -1);  // too big just goes over
+            ValueDicts *rows = unspill(partition);
+            for (auto const row: *rows) {
+                partition_groups.add(row);
+                delete row;
+            }
+            delete rows;
+            partition_groups.results(*results, arena);
+        }
+    } catch (...) {
+        drop_partitions(partitions);
+        if (arena == nullptr) {
+            for (auto const row: *results)
+                delete row;
+            delete results;
+        }
+        throw;
+    }
+    drop_partitions(partitions);
+    return results;
+}
+
+// Compute an aggregation over a whole table without reading its rows, if it can be: with no group-by columns, and
+// each function either COUNT, which is the table's row count (there are no NULLs to leave out), or MIN or MAX of
+// the leading column of an ordered index, which is in the row at that end of the index. Returns false, having made
+// no rows, if it can't be.
+bool EvalPlan::aggregate_without_rows(const std::vector<ColumnAttribute::DataType> &types, ValueDicts &results,
+                                      Arena *arena) {
+    if (!this->aggregation->group_by.empty() ||
+        (this->relation->type != Project && this->relation->type != ProjectAll) ||
+        this->relation->relation->type != TableScan)
+        return false;
+    const EvalPlan *scan = this->relation->relation;
+    std::vector<DbIndex *> edges;
+    for (auto const &function: this->aggregation->functions) {
+        DbIndex *edge = nullptr;
+        if (function.function == AggregateFunction::MIN || function.function == AggregateFunction::MAX) {
+            for (auto const index: scan->indices)
+                if (index->has_range() && index->get_key_columns()[0] == function.column_name)
+                    edge = index;
+            if (edge == nullptr)
+                return false;
+        } else if (function.function != AggregateFunction::COUNT) {
+            return false;
+        }
+        edges.push_back(edge);
+    }
+
+    ValueDict *row = new_row(arena);
+    try {
+        size_t count = (size_t) -1;
+        for (uint i = 0; i < edges.size(); i++) {
+            const AggregateFunction &function = this->aggregation->functions[i];
+            GroupTable::Accumulator accumulator{0, 0, Value()};
+            if (edges[i] == nullptr) {
+                if (count == (size_t) -1)
+                    count = scan->table.count();
+                accumulator.count = (int64_t) count;
+            } else {
+                Handles *handles = edges[i]->edge(function.function == AggregateFunction::MAX);
+                if (!handles->empty()) {
+                    ColumnNames column_names(1, function.column_name);
+                    ValueDict *values = scan->table.project(handles->front(), &column_names);
+                    accumulator.count = 1;
+                    accumulator.extreme = values->at(function.column_name);
+                    delete values;
+                }
+                delete handles;
+            }
+            (*row)[function.name] = GroupTable::result(function, types[i], accumulator);
+        }
+    } catch (...) {
+        if (arena == nullptr)
+            delete row;
+        throw;
+    }
+    results.push_back(row);
+    return true;
+}
+
+// Keep the first of each set of rows with the same values in all of their columns. If the rows come with each such
+// set together (see ordered_by), each row need only be compared with the one before it. Otherwise the rows' keys
+// (their values packed into a string, as for a hash join) are kept in a hash set; once the keys take up more than
+// distinct_memory, the rows whose keys aren't in the set are spilled by key hash to partitions on disk instead,
+// and each partition is then made distinct on its own.
+ValueDicts *EvalPlan::distinct(Arena *arena) {
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    this->relation->get_columns(column_names, column_attributes);
+    bool adjacent = this->relation->ordered_by(column_names);
+
+    std::vector<HeapTable *> partitions;
+    ValueDicts *results = new_rows(arena);
+    try {
+        std::unordered_set<std::string> keys;
+        std::string previous;
+        size_t bytes = 0;
+        RowSlices slices(this->relation);
+        ValueDicts *slice;
+        while ((slice = slices.next()) != nullptr) {
+            for (auto const row: *slice) {
+                std::string key;
+                HashJoinTable::join_key(row, column_names, key);
+                if (adjacent) {
+                    if (!results->empty() && key == previous) {
+                        delete row;
+                    } else {
+                        keep_row(row, *results, arena);
+                        previous.swap(key);
+                    }
+                } else if (keys.count(key) > 0) {
+                    delete row;
+                } else if (bytes > distinct_memory) {
+                    if (partitions.empty())
+                        make_partitions(this->relation, "distinct", DISTINCT_PARTITIONS, partitions);
+                    spill_row(row, column_names, partitions);
+                    delete row;
+                } else {
+                    bytes += key.size() + sizeof(std::string) + 2 * sizeof(void *);
+                    keys.insert(key);
+                    keep_row(row, *results, arena);
+                }
+            }
+            delete slice;
+        }
+        for (auto const partition: partitions) {
+            keys.clear();
+            ValueDicts *rows = unspill(partition);
+            for (auto const row: *rows) {
+                std::string key;
+                HashJoinTable::join_key(row, column_names, key);
+                if (keys.insert(key).second)
+                    keep_row(row, *results, arena);
+                else
+                    delete row;
+            }
+            delete rows;
+        }
+    } catch (...) {
+        drop_partitions(partitions);
+        if (arena == nullptr) {
+            for (auto const row: *results)
+                delete row;
+            delete results;
+        }
+        throw;
+    }
+    drop_partitions(partitions);
+    return results;
+}
+
+// Whether equal values of the columns come together: the plan is sorted on them (in any order and directions)
+// ahead of any other columns, or gets its rows in the key order of an index on them, or scans a table kept in a
+// btree on its primary key.
+bool EvalPlan::ordered_by(const ColumnNames &column_names) const {
+    std::set<Identifier> wanted(column_names.begin(), column_names.end());
+    auto leading = [&wanted](const ColumnNames &order) {
+        return order.size() >= wanted.size() &&
+               std::set<Identifier>(order.begin(), order.begin() + wanted.size()) == wanted;
+    };
+    switch (this->type) {
+        case ProjectAll:
+        case Select:
+        case Limit:
+            return this->relation->ordered_by(column_names);
+        case Project: {
+            if (this->renames == nullptr)
+                return this->relation->ordered_by(column_names);
+            ColumnNames projected;
+            for (auto const &column_name: column_names) {
+                auto found = std::find(this->renames->begin(), this->renames->end(), column_name);
+                if (found == this->renames->end())
+                    return false;
+                projected.push_back((*this->projection)[found - this->renames->begin()]);
+            }
+            return this->relation->ordered_by(projected);
+        }
+        case Sort:
+        case TopN: {
+            ColumnNames order;
+            for (auto const &column: *this->sort_order)
+                order.push_back(column.first);
+            return leading(order);
+        }
+        case TableScan:
+            return dynamic_cast<const BTreeRelation *>(&this->table) != nullptr &&
+                   leading(ColumnNames(1, this->table.get_column_names()[0]));
+        case IndexLookup:
+        case IndexRange:
+            return this->index->has_range() && leading(this->index->get_key_columns());
+        default:
+            return false;
+    }
+}
+
+// Whether the plan is expected to give just a few rows: when it is driven by index lookups (and not ranges or
+// scans), including an IndexJoin with such a probe side.
+bool EvalPlan::is_small() const {
+    switch (this->type) {
+        case ProjectAll:
+        case Project:
+        case Select:
+            return this->relation->is_small();
+        case IndexLookup:
+        case IndexBatch:
+            return true;
+        case BitmapAnd:
+            for (auto const input: this->inputs)
+                if (input->is_small())
+                    return true;
+            return false;
+        case BitmapOr:
+            for (auto const input: this->inputs)
+                if (!input->is_small())
+                    return false;
+            return true;
+        case IndexJoin:
+            return this->inputs[0]->is_small();
+        default:
+            return false;
+    }
+}
+
+// The best index for an IndexJoin in place of the given HashJoin: one on the build table whose leading key
+// columns are among the build keys (the more of them the better), if the build side is a projection of a table,
+// perhaps with conditions.
+DbIndex *EvalPlan::join_index(const EvalPlan *join) {
+    const EvalPlan *build = join->inputs[1];
+    if (build->type != Project || join->build_keys->empty())
+        return nullptr;
+    const EvalPlan *source = build->relation->type == Select ? build->relation->relation : build->relation;
+    if (source->type != TableScan)
+        return nullptr;
+    const ColumnNames &build_names = build->renames != nullptr ? *build->renames : *build->projection;
+    ColumnNames build_columns;
+    for (auto const &build_key: *join->build_keys) {
+        auto found = std::find(build_names.begin(), build_names.end(), build_key);
+        if (found == build_names.end())
+            return nullptr;
+        build_columns.push_back((*build->projection)[found - build_names.begin()]);
+    }
+    DbIndex *best = nullptr;
+    uint best_given = 0;
+    for (auto const index: source->indices) {
+        const ColumnNames &key_columns = index->get_key_columns();
+        uint given = 0;
+        while (given < key_columns.size() &&
+               std::find(build_columns.begin(), build_columns.end(), key_columns[given]) != build_columns.end())
+            given++;
+        if (index->min_lookup_columns() > 0 && given >= index->min_lookup_columns() && given > best_given) {
+            best = index;
+            best_given = given;
+        }
+    }
+    return best;
+}
+
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexLookup) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->lookup(this->key));
+    }
+    if (this->type == IndexRange) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->range(this->key, this->max_key));
+    }
+    if (this->type == IndexBatch) {
+        this->index->open();
+        std::vector<Handles *> results = this->index->lookup_batch(*this->keys);
+        Handles *handles = new Handles();
+        for (auto const result: results) {
+            handles->insert(handles->end(), result->begin(), result->end());
+            delete result;
+        }
+        return EvalPipeline(&this->table, handles);
+    }
+    if (this->type == BitmapAnd || this->type == BitmapOr) {
+        HandleBitmap bitmap;
+        for (uint i = 0; i < this->inputs.size(); i++) {
+            EvalPipeline input = this->inputs[i]->pipeline();
+            HandleBitmap handles(*input.second);
+            delete input.second;
+            if (i == 0)
+                bitmap.swap(handles);
+            else if (this->type == BitmapAnd)
+                bitmap.intersect(handles);
+            else
+                bitmap.unite(handles);
+        }
+        return EvalPipeline(&this->table, bitmap.handles());
+    }
     if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->relation->table, this->relation->table.select(*this->select_conjunction));
 
     // recursive case
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
         Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+        EvalPipeline ret(temp_table, temp_table->select(handles, *this->select_conjunction));
         delete handles;
         return ret;
     }
 
     throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
 }
+
+HandleBitmap::HandleBitmap(const Handles &handles) : blocks() {
+    for (auto const &handle: handles)
+        add(handle);
+}
+
+void HandleBitmap::add(Handle handle) {
+    Bits &bits = blocks[handle.first];
+    uint word = handle.second / 64;
+    if (word >= bits.size())
+        bits.resize(word + 1, 0);
+    bits[word] |= (uint64_t) 1 << (handle.second % 64);
+}
+
+// Keep only the handles also in other (dropping blocks left empty).
+void HandleBitmap::intersect(const HandleBitmap &other) {
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        auto found = other.blocks.find(it->first);
+        bool empty = true;
+        if (found != other.blocks.end()) {
+            Bits &bits = it->second;
+            const Bits &other_bits = found->second;
+            if (bits.size() > other_bits.size())
+                bits.resize(other_bits.size());
+            for (uint i = 0; i < bits.size(); i++) {
+                bits[i] &= other_bits[i];
+                if (bits[i] != 0)
+                    empty = false;
+            }
+        }
+        if (empty)
+            it = blocks.erase(it);
+        else
+            it++;
+    }
+}
+
+void HandleBitmap::unite(const HandleBitmap &other) {
+    for (auto const &block: other.blocks) {
+        Bits &bits = blocks[block.first];
+        if (bits.size() < block.second.size())
+            bits.resize(block.second.size(), 0);
+        for (uint i = 0; i < block.second.size(); i++)
+            bits[i] |= block.second[i];
+    }
+}
+
+Handles *HandleBitmap::handles() const {
+    Handles *handles = new Handles();
+    for (auto const &block: blocks)
+        for (uint i = 0; i < block.second.size(); i++)
+            for (uint64_t word = block.second[i]; word != 0; word &= word - 1)
+                handles->push_back(Handle(block.first, (RecordID) (64 * i + __builtin_ctzll(word))));
+    return handles;
+}
+
+
+// The rows of a test table under joined names: alias.a and alias.b.
+static EvalPlan *test_side(DbRelation &table, const char *alias) {
+    ColumnNames *projection = new ColumnNames();
+    ColumnNames *renames = new ColumnNames();
+    for (auto const &column_name: table.get_column_names()) {
+        projection->push_back(column_name);
+        renames->push_back(std::string(alias) + "." + column_name);
+    }
+    return new EvalPlan(projection, renames, new EvalPlan(table));
+}
+
+// Free the rows a plan got, and the plan.
+static void test_free(ValueDicts *rows, EvalPlan *plan) {
+    for (auto const row: *rows)
+        delete row;
+    delete rows;
+    delete plan;
+}
+
+// Check the join of the 300 left rows with the 600 right rows on l.a = r.a: two right rows for each left row.
+static bool test_join(DbRelation &left, DbRelation &right) {
+    ColumnNames *probe_keys = new ColumnNames();
+    probe_keys->push_back("l.a");
+    ColumnNames *build_keys = new ColumnNames();
+    build_keys->push_back("r.a");
+    EvalPlan *plan = new EvalPlan(test_side(left, "l"), test_side(right, "r"), probe_keys, build_keys);
+    ValueDicts *rows = plan->evaluate();
+    bool ok = rows->size() == 600;
+    std::map<int32_t, int> matches;
+    for (auto const row: *rows) {
+        int32_t a = row->at("l.a").n;
+        if (row->at("r.a").n != a || row->at("l.b").s() != "left " + std::to_string(a) ||
+            std::stoi(row->at("r.b").s().substr(6)) % 300 != a)
+            ok = false;
+        matches[a]++;
+        delete row;
+    }
+    delete rows;
+    delete plan;
+    for (auto const &match: matches)
+        if (match.second != 2)
+            ok = false;
+    return ok && matches.size() == 300;
+}
+
+// An Aggregate of the n column of a test table (COUNT of the rows), grouped by its g column or not.
+static EvalPlan *test_aggregate(DbRelation &table, const DbIndexes &indices, bool grouped,
+                                const std::vector<AggregateFunction::Function> &functions) {
+    static const char *names[] = {"count", "sum", "min", "max", "avg"};
+    Aggregation *aggregation = new Aggregation();
+    if (grouped)
+        aggregation->group_by.push_back("g");
+    for (auto const function: functions)
+        aggregation->functions.push_back(
+                AggregateFunction(function, function == AggregateFunction::COUNT ? "" : "n", names[function]));
+    return new EvalPlan(aggregation, new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(table, indices)));
+}
+
+// Check a plan gets one row, with zero for all its values.
+static bool test_zeros(EvalPlan *plan) {
+    ValueDicts *rows = plan->evaluate();
+    bool ok = rows->size() == 1;
+    for (auto const row: *rows)
+        for (auto const &column: *row)
+            if (column.second.n != 0)
+                ok = false;
+    test_free(rows, plan);
+    return ok;
+}
+
+// Check a Distinct of the a column of the right rows gets each of its 300 values once (in order, if asked).
+static bool test_distinct(DbRelation &right, bool sorted) {
+    EvalPlan *plan = new EvalPlan(new ColumnNames(1, "a"), new EvalPlan(right));
+    if (sorted) {
+        SortOrder *sort_order = new SortOrder();
+        sort_order->push_back(std::make_pair("a", false));
+        plan = new EvalPlan(sort_order, plan);
+    }
+    plan = new EvalPlan(EvalPlan::Distinct, plan);
+    ValueDicts *rows = plan->evaluate();
+    bool ok = rows->size() == 300;
+    std::set<int32_t> seen;
+    for (auto const row: *rows)
+        if (!seen.insert(row->at("a").n).second || (sorted && row->at("a").n != (int32_t) seen.size() - 1))
+            ok = false;
+    test_free(rows, plan);
+    return ok && *seen.begin() == 0 && *seen.rbegin() == 299;
+}
+
+/**
+ * Testing function for the evaluation plans that make rows of their own.
+ * @return true if the tests all succeeded
+ */
+bool test_eval_plan() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable left("__test_eval_left", column_names, column_attributes);
+    left.create();
+    HeapTable right("__test_eval_right", column_names, column_attributes);
+    right.create();
+    ValueDict row;
+    for (int i = 0; i < 300; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("left " + std::to_string(i));
+        left.insert(&row);
+    }
+    for (int i = 0; i < 600; i++) {
+        row["a"] = Value(i % 300);
+        row["b"] = Value("right " + std::to_string(i));
+        right.insert(&row);
+    }
+
+    // a hash join in memory, then one whose build side is spilled to partitions almost at once
+    if (!test_join(left, right)) {
+        std::cout << "hash join failed" << std::endl;
+        return false;
+    }
+    size_t join_memory = EvalPlan::join_memory;
+    EvalPlan::join_memory = 2000;
+    bool spilled = test_join(left, right);
+    EvalPlan::join_memory = join_memory;
+    if (!spilled) {
+        std::cout << "spilled hash join failed" << std::endl;
+        return false;
+    }
+    std::cout << "hash join ok" << std::endl;
+
+    // an external merge sort of many small runs, on a key descending and then one ascending
+    size_t sort_memory = EvalPlan::sort_memory;
+    EvalPlan::sort_memory = 2000;
+    SortOrder *sort_order = new SortOrder();
+    sort_order->push_back(std::make_pair("a", true));
+    sort_order->push_back(std::make_pair("b", false));
+    EvalPlan *plan = new EvalPlan(sort_order, new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(right)));
+    ValueDicts *rows = plan->evaluate();
+    EvalPlan::sort_memory = sort_memory;
+    bool sorted = rows->size() == 600;
+    for (uint i = 1; i < rows->size() && sorted; i++) {
+        const ValueDict &before = *(*rows)[i - 1], &after = *(*rows)[i];
+        int32_t a_before = before.at("a").n, a_after = after.at("a").n;
+        sorted = a_before > a_after || (a_before == a_after && before.at("b") < after.at("b"));
+    }
+    test_free(rows, plan);
+    if (!sorted) {
+        std::cout << "external sort failed" << std::endl;
+        return false;
+    }
+    std::cout << "external sort ok" << std::endl;
+
+    // hash aggregation of 1000 rows into 97 groups, most of which are spilled
+    column_names.back() = "n";
+    column_names.front() = "g";
+    column_attributes.back() = ColumnAttribute(ColumnAttribute::INT);
+    HeapTable groups("__test_eval_groups", column_names, column_attributes);
+    groups.create();
+    ValueDict group_row;
+    for (int i = 0; i < 1000; i++) {
+        group_row["g"] = Value(i % 97);
+        group_row["n"] = Value(i - 400);
+        groups.insert(&group_row);
+    }
+    std::vector<AggregateFunction::Function> all = {AggregateFunction::COUNT, AggregateFunction::SUM,
+                                                    AggregateFunction::MIN, AggregateFunction::MAX,
+                                                    AggregateFunction::AVG};
+    size_t aggregate_memory = EvalPlan::aggregate_memory;
+    EvalPlan::aggregate_memory = 500;
+    plan = test_aggregate(groups, DbIndexes(), true, all);
+    rows = plan->evaluate();
+    EvalPlan::aggregate_memory = aggregate_memory;
+    bool aggregated = rows->size() == 97;
+    std::set<int32_t> seen;
+    for (auto const row: *rows) {
+        int32_t g = row->at("g").n;
+        int32_t count = 0, sum = 0;
+        for (int i = g; i < 1000; i += 97) {
+            count++;
+            sum += i - 400;
+        }
+        if (!seen.insert(g).second || row->at("count").n != count || row->at("sum").n != sum ||
+            row->at("min").n != g - 400 || row->at("max").n != g + 97 * (count - 1) - 400 ||
+            row->at("avg").n != sum / count)
+            aggregated = false;
+    }
+    test_free(rows, plan);
+    if (!aggregated) {
+        std::cout << "spilled aggregation failed" << std::endl;
+        return false;
+    }
+
+    // COUNT(*), MIN and MAX of the whole table come from the block headers and the edges of an index (so a row
+    // left out of the index is counted but can't be the greatest)
+    BTreeIndex index(groups, "__test_eval_groups_n", ColumnNames(1, "n"), false);
+    index.create();
+    group_row["n"] = Value(5000);
+    groups.insert(&group_row);
+    DbIndexes indices(1, &index);
+    std::vector<AggregateFunction::Function> edges = {AggregateFunction::COUNT, AggregateFunction::MIN,
+                                                      AggregateFunction::MAX};
+    plan = test_aggregate(groups, indices, false, edges);
+    rows = plan->evaluate();
+    bool from_index = rows->size() == 1 && rows->front()->at("count").n == 1001 &&
+                      rows->front()->at("min").n == -400 && rows->front()->at("max").n == 599;
+    test_free(rows, plan);
+    if (!from_index) {
+        std::cout << "aggregation from index edges failed" << std::endl;
+        return false;
+    }
+
+    // over no rows: one row of zeros without GROUP BY, no rows with it
+    groups.truncate();
+    index.truncate();
+    if (!test_zeros(test_aggregate(groups, indices, false, edges)) ||
+        !test_zeros(test_aggregate(groups, DbIndexes(), false, all))) {
+        std::cout << "aggregation of no rows failed" << std::endl;
+        return false;
+    }
+    plan = test_aggregate(groups, DbIndexes(), true, all);
+    rows = plan->evaluate();
+    bool none = rows->empty();
+    test_free(rows, plan);
+    if (!none) {
+        std::cout << "grouping of no rows failed" << std::endl;
+        return false;
+    }
+    std::cout << "aggregation ok" << std::endl;
+    index.drop();
+    groups.drop();
+
+    // DISTINCT with a hash set of the keys, then with most of the rows spilled, then over rows already in order
+    // (which are compared with the row before, whatever the budget)
+    size_t distinct_memory = EvalPlan::distinct_memory;
+    bool hashed = test_distinct(right, false);
+    EvalPlan::distinct_memory = 200;
+    bool spilled_distinct = test_distinct(right, false);
+    EvalPlan::distinct_memory = 0;
+    bool adjacent = test_distinct(right, true);
+    EvalPlan::distinct_memory = distinct_memory;
+    if (!hashed || !spilled_distinct || !adjacent) {
+        std::cout << "distinct failed: " << hashed << spilled_distinct << adjacent << std::endl;
+        return false;
+    }
+    std::cout << "distinct ok" << std::endl;
+
+    right.drop();
+    left.drop();
+    return true;
+}
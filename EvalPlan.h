@@ -10,17 +10,134 @@
 
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
+typedef std::vector<std::pair<Identifier, bool> > SortOrder;  // columns to sort by, each with whether descending
+
+/**
+ * @class HandleBitmap - a set of handles kept as a bitmap of record ids for each block
+ *
+ * Handle sets from several index searches are intersected or united a word at a time, and come back out
+ * sorted by block, so the rows can be fetched visiting each block just once.
+ */
+class HandleBitmap {
+public:
+    HandleBitmap() : blocks() {}
+
+    explicit HandleBitmap(const Handles &handles);
+
+    void add(Handle handle);
+
+    void intersect(const HandleBitmap &other);
+
+    void unite(const HandleBitmap &other);
+
+    void swap(HandleBitmap &other) { blocks.swap(other.blocks); }
+
+    /**
+     * The handles in the set.
+     * @returns  the handles in block id order, and record id order within a block (freed by caller)
+     */
+    Handles *handles() const;
+
+protected:
+    typedef std::vector<uint64_t> Bits;  // bit r % 64 of word r / 64 is record id r
+    std::map<BlockID, Bits> blocks;
+};
+
+/**
+ * @class AggregateFunction - one of the values an Aggregate computes for each group
+ */
+class AggregateFunction {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX, AVG
+    };
+    Function function;
+    Identifier column_name;  // the column it is computed over (empty for COUNT(*))
+    Identifier name;  // what the results call it
+
+    AggregateFunction(Function function, Identifier column_name, Identifier name)
+            : function(function), column_name(column_name), name(name) {}
+};
+
+/**
+ * @class Aggregation - what an Aggregate computes: a row for each group of rows with the same values in the
+ * group_by columns (or one row for all of the rows if there are none), holding those values and the functions
+ */
+class Aggregation {
+public:
+    ColumnNames group_by;
+    std::vector<AggregateFunction> functions;
+};
 
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexLookup, IndexRange, IndexBatch, BitmapAnd, BitmapOr, HashJoin,
+        IndexJoin, Sort, TopN, Limit, Aggregate, Distinct
     };
 
+    /**
+     * Approximate number of bytes of build rows a HashJoin holds in memory before it spills to partitions
+     */
+    static size_t join_memory;
+
+    /**
+     * Number of partitions of each side a spilling HashJoin makes
+     */
+    static const uint JOIN_PARTITIONS = 32;
+
+    /**
+     * Number of outer rows an IndexJoin looks up in the inner index at a time
+     */
+    static const uint JOIN_BATCH = 1024;
+
+    /**
+     * Approximate number of bytes of rows a Sort holds in memory before it spills them as a sorted run
+     */
+    static size_t sort_memory;
+
+    /**
+     * Limit of a Limit that keeps all the rows (after its offset)
+     */
+    static const size_t NO_LIMIT = (size_t) -1;
+
+    /**
+     * Approximate number of bytes of groups an Aggregate holds in memory; rows of further groups are spilled
+     */
+    static size_t aggregate_memory;
+
+    /**
+     * Number of partitions a spilling Aggregate makes
+     */
+    static const uint AGGREGATE_PARTITIONS = 32;
+
+    /**
+     * Approximate number of bytes of row keys a Distinct holds in memory; rows with further keys are spilled
+     */
+    static size_t distinct_memory;
+
+    /**
+     * Number of partitions a spilling Distinct makes
+     */
+    static const uint DISTINCT_PARTITIONS = 32;
+
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
+    // (and for Distinct, e.g., EvalPlan(EvalPlan::Distinct, projection))
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
-    EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(ColumnNames *projection, ColumnNames *renames, EvalPlan *relation); // use for Project with renaming
+    EvalPlan(Conjunction *conjunction, EvalPlan *relation);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbRelation &table, const DbIndexes &indices);  // use for TableScan of a table with indices
+    EvalPlan(DbIndex &index, ValueDict *key, DbRelation &table);  // use for IndexLookup
+    EvalPlan(DbIndex &index, ValueDict *min_key, ValueDict *max_key, DbRelation &table);  // use for IndexRange
+    EvalPlan(DbIndex &index, ValueDicts *keys, DbRelation &table);  // use for IndexBatch
+    EvalPlan(PlanType type, const std::vector<EvalPlan *> &inputs, DbRelation &table);  // use for BitmapAnd, BitmapOr
+    EvalPlan(EvalPlan *probe, EvalPlan *build, ColumnNames *probe_keys, ColumnNames *build_keys);  // use for HashJoin
+    // (the optimizer turns a HashJoin into an IndexJoin of the same inputs)
+    EvalPlan(SortOrder *sort_order, EvalPlan *relation);  // use for Sort
+    EvalPlan(SortOrder *sort_order, size_t limit, size_t offset, EvalPlan *relation);  // use for TopN
+    EvalPlan(size_t limit, size_t offset, EvalPlan *relation);  // use for Limit
+    EvalPlan(Aggregation *aggregation, EvalPlan *relation);  // use for Aggregate
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
@@ -28,15 +145,72 @@ public:
     EvalPlan *optimize();
 
     // Evaluate the plan: evaluate gets values, pipeline gets handles
-    ValueDicts *evaluate();
+    // (if given an arena, the values are made there and freed along with it)
+    ValueDicts *evaluate(Arena *arena = nullptr);
 
     EvalPipeline pipeline();
 
+    // The columns of the rows evaluate gets (for ProjectAll, Project and the plans that make rows, see has_rows)
+    void get_columns(ColumnNames &column_names, ColumnAttributes &column_attributes) const;
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
+    EvalPlan *relation;  // for ProjectAll, Project, Select, Sort, TopN, Limit, Aggregate and Distinct
     ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    ColumnNames *renames;  // for Project: what to call the projected columns in the results (nullptr to keep)
+    Conjunction *select_conjunction;  // for Select
+    ValueDict *key;  // the search key for IndexLookup; the lower bound for IndexRange (nullptr for none)
+    ValueDict *max_key;  // the upper bound for IndexRange (nullptr for none)
+    ValueDicts *keys;  // the search keys for IndexBatch
+    std::vector<EvalPlan *> inputs;  // for BitmapAnd and BitmapOr: the searches; for the joins: probe and build
+    ColumnNames *probe_keys;  // for the joins: the columns of the probe rows to match...
+    ColumnNames *build_keys;  // ...to these columns of the build rows, pairwise
+    SortOrder *sort_order;  // for Sort and TopN
+    size_t limit;  // for TopN and Limit: how many rows to keep...
+    size_t offset;  // ...after skipping this many
+    Aggregation *aggregation;  // for Aggregate
+    DbRelation &table;  // for TableScan, the index searches, BitmapAnd and BitmapOr
+    DbIndexes indices;  // for TableScan: the table's indices the optimizer may use instead
+    DbIndex *index;  // for IndexLookup, IndexRange and IndexBatch; for IndexJoin: the build table's index to use
+
+    static EvalPlan *use_indices(EvalPlan *plan);
+
+    ValueDicts *project(DbRelation *table, Handles *handles, Arena *arena);
+
+    ValueDicts *hash_join(Arena *arena);
+
+    ValueDicts *index_join(Arena *arena);
+
+    ValueDicts *sort(Arena *arena);
+
+    ValueDicts *top_n(Arena *arena);
+
+    ValueDicts *limit_rows(Arena *arena);
+
+    ValueDicts *aggregate(Arena *arena);
+
+    bool aggregate_without_rows(const std::vector<ColumnAttribute::DataType> &types, ValueDicts &results,
+                                Arena *arena);
+
+    ValueDicts *distinct(Arena *arena);
+
+    bool is_join() const { return this->type == HashJoin || this->type == IndexJoin; }
+
+    // whether evaluate gets the rows itself (rather than from the handles of its relation's pipeline)
+    bool has_rows() const {
+        return is_join() || this->type == Sort || this->type == TopN || this->type == Limit ||
+               this->type == Aggregate || this->type == Distinct;
+    }
+
+    // whether the rows evaluate gets have those with the same values in the given columns next to each other
+    bool ordered_by(const ColumnNames &column_names) const;
+
+    bool is_small() const;
+
+    static DbIndex *join_index(const EvalPlan *join);
+
+    friend class RowSlices;
 };
+
+bool test_eval_plan();
@@ -51,6 +51,18 @@ void HeapFile::close(void) {
     this->closed = true;
 }
 
+/**
+ * Empty the physical file in place (with the handle left open), then give it one page again as create() does.
+ */
+void HeapFile::truncate(void) {
+    open();
+    u_int32_t count;
+    this->db.truncate(nullptr, &count, 0);
+    this->last = 0;
+    SlottedPage *page = get_new();
+    delete page;
+}
+
 /**
  * Allocate a new block for the database file.
  * @return the new empty DbBlock that is managing the records in this block and its block id.
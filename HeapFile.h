@@ -41,6 +41,8 @@ public:
 
     virtual void close(void);
 
+    virtual void truncate(void);
+
     virtual SlottedPage *get_new(void);
 
     virtual SlottedPage *get(BlockID block_id);
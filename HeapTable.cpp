@@ -3,6 +3,7 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "HeapTable.h"
 
@@ -16,7 +17,11 @@ typedef uint16_t u16;
  * @param column_attributes
  */
 HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : DbRelation(
-        table_name, column_names, column_attributes), file(table_name) {
+        table_name, column_names, column_attributes), file(table_name), all_columns(),
+                                                                  codec(column_names, column_attributes),
+                                                                  zone_map(codec) {
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++)
+        all_columns.push_back(col_num);
 }
 
 /**
@@ -24,6 +29,7 @@ HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttr
  * Is not responsible for metadata storage or validation.
  */
 void HeapTable::create() {
+    zone_map.clear();
     file.create();
 }
 
@@ -43,9 +49,19 @@ void HeapTable::create_if_not_exists() {
  * Execute: DROP TABLE <table_name>
  */
 void HeapTable::drop() {
+    zone_map.clear();
     file.drop();
 }
 
+/**
+ * Execute: TRUNCATE TABLE <table_name>
+ * Empties the file (and forgets the block summaries) without looking at the rows.
+ */
+void HeapTable::truncate() {
+    zone_map.clear();
+    file.truncate();
+}
+
 /**
  * Open existing table. Enables: insert, update, delete, select, project
  */
@@ -77,11 +93,79 @@ Handle HeapTable::insert(const ValueDict *row) {
  * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
  * where handle is sufficient to identify one specific record (e.g., returned from an insert
  * or select).
+ * The record is rewritten in place if it still fits in its block. If not, the row moves to the end of the file and
+ * its record is replaced by the handle of where it went (a forward), so the row keeps its handle and any index
+ * entries for it stay good. A row that has already moved is rewritten where it is, or brought back home if it
+ * fits there again. The block's zone map summary is widened to cover the new values.
  * @param handle the row to be updated
  * @param new_values a dictionary with column name keys
  */
 void HeapTable::update(const Handle handle, const ValueDict *new_values) {
-    throw DbRelationError("Not implemented");
+    open();
+    ValueDict *row = project(handle);
+    for (auto const &column: *new_values) {
+        if (row->find(column.first) == row->end()) {
+            delete row;
+            throw DbRelationError("unknown column " + column.first);
+        }
+        (*row)[column.first] = column.second;
+    }
+    Dbt *data;
+    try {
+        data = marshal(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+
+    SlottedPage *block = this->file.get(handle.first);
+    bool forwarded = block->get_flags(handle.second) & SlottedPage::FORWARD;
+    Handle moved_to = forwarded ? forward(block, handle.second) : Handle(0, 0);
+    try {
+        block->put(handle.second, *data);
+        if (forwarded)
+            remove(moved_to);
+    } catch (DbBlockNoRoomError &e) {
+        bool rewritten = false;
+        if (forwarded) {
+            SlottedPage *moved_block = this->file.get(moved_to.first);
+            try {
+                moved_block->put(moved_to.second, *data);
+                moved_block->set_flags(moved_to.second, SlottedPage::MOVED);
+                this->file.put(moved_block);
+                rewritten = true;
+            } catch (DbBlockNoRoomError &e) {
+                // move it again
+            }
+            delete moved_block;
+        }
+        if (!rewritten) {
+            Handle moved_from = moved_to;
+            moved_to = relocate(*data, handle.first);
+            char address[sizeof(BlockID) + sizeof(RecordID)];
+            memcpy(address, &moved_to.first, sizeof(BlockID));
+            memcpy(address + sizeof(BlockID), &moved_to.second, sizeof(RecordID));
+            Dbt address_dbt(address, sizeof(address));
+            try {
+                block->put(handle.second, address_dbt);
+            } catch (DbBlockNoRoomError &e) {
+                remove(moved_to);
+                delete block;
+                delete[] (char *) data->get_data();
+                delete data;
+                throw DbRelationError("no room to move the row");
+            }
+            block->set_flags(handle.second, SlottedPage::FORWARD);
+            if (forwarded)
+                remove(moved_from);
+        }
+    }
+    this->zone_map.add(handle.first, (const char *) data->get_data());
+    this->file.put(block);
+    delete block;
+    delete[] (char *) data->get_data();
+    delete data;
 }
 
 /**
@@ -95,6 +179,8 @@ void HeapTable::del(const Handle handle) {
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = this->file.get(block_id);
+    if (block->get_flags(record_id) & SlottedPage::FORWARD)
+        remove(forward(block, record_id));
     block->del(record_id);
     this->file.put(block);
     delete block;
@@ -114,22 +200,47 @@ Handles *HeapTable::select() {
  * @return list of handles of the selected rows
  */
 Handles *HeapTable::select(const ValueDict *where) {
+    return scan(RecordMatcher(this->codec, where));
+}
+
+/**
+ * The select command
+ * @param where comparisons that must all hold
+ * @return list of handles of the selected rows
+ */
+Handles *HeapTable::select(const Conjunction &where) {
+    return scan(RecordMatcher(this->codec, where));
+}
+
+/**
+ * The select command, stopping once enough rows are found
+ * @param where comparisons that must all hold
+ * @param limit most handles wanted
+ * @return list of handles of the first limit selected rows
+ */
+Handles *HeapTable::select(const Conjunction &where, size_t limit) {
+    return scan(RecordMatcher(this->codec, where), limit);
+}
+
+/**
+ * Count the rows from each block's header, without looking at the records.
+ * @return number of rows in the table
+ */
+size_t HeapTable::count() {
     open();
-    Handles *handles = new Handles();
+    size_t n = 0;
     BlockIDs *block_ids = file.block_ids();
     for (auto const &block_id: *block_ids) {
         SlottedPage *block = file.get(block_id);
         RecordIDs *record_ids = block->ids();
-        for (auto const &record_id: *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(handle);
-        }
+        for (auto const &record_id: *record_ids)
+            if (!(block->get_flags(record_id) & SlottedPage::MOVED))  // counted at its forward
+                n++;
         delete record_ids;
         delete block;
     }
     delete block_ids;
-    return handles;
+    return n;
 }
 
 /**
@@ -140,10 +251,86 @@ Handles *HeapTable::select(const ValueDict *where) {
  * @return                  list of handles of the selected rows
  */
 Handles *HeapTable::select(Handles *current_selection, const ValueDict *where) {
+    return filter(current_selection, RecordMatcher(this->codec, where));
+}
+
+/**
+ * Refine another selection
+ *
+ * @param current_selection range of handles to filter
+ * @param where             comparisons that must all hold
+ * @return                  list of handles of the selected rows
+ */
+Handles *HeapTable::select(Handles *current_selection, const Conjunction &where) {
+    return filter(current_selection, RecordMatcher(this->codec, where));
+}
+
+/**
+ * Find all the rows in the file that satisfy the compiled where clause.
+ * Blocks whose zone map summary rules them out aren't read; the others get summarized as they are read.
+ * Once limit rows are found no more blocks are read (the block at hand is still read through, so that its
+ * summary is complete).
+ * @param matcher  compiled conditions to check
+ * @param limit    most handles wanted
+ * @return         list of handles of the selected rows
+ */
+Handles *HeapTable::scan(const RecordMatcher &matcher, size_t limit) {
+    open();
     Handles *handles = new Handles();
-    for (auto const &handle: *current_selection)
-        if (selected(handle, where))
+    BlockIDs *block_ids = file.block_ids();
+    for (auto const &block_id: *block_ids) {
+        if (!matcher.may_match(zone_map, block_id))
+            continue;
+        bool summarize = !zone_map.summarized(block_id);
+        if (summarize)
+            zone_map.start(block_id);
+        SlottedPage *block = file.get(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const &record_id: *record_ids) {
+            if (block->get_flags(record_id) & SlottedPage::MOVED)
+                continue;  // found through its forward
+            SlottedPage *moved;
+            const char *record = locate(block, record_id, moved);
+            if (summarize)
+                zone_map.add(block_id, record);
+            if (handles->size() < limit && matcher.matches(record))
+                handles->push_back(Handle(block_id, record_id));
+            delete moved;
+        }
+        delete record_ids;
+        delete block;
+        if (handles->size() >= limit)
+            break;
+    }
+    delete block_ids;
+    return handles;
+}
+
+/**
+ * Keep just the rows of another selection that satisfy the compiled where clause.
+ * Consecutive handles in the same block share one fetch of that block (so a selection sorted by block
+ * reads each block once), and blocks whose zone map summary rules them out aren't read at all.
+ * @param current_selection  handles to filter
+ * @param matcher            compiled conditions to check
+ * @return                   list of handles of the selected rows
+ */
+Handles *HeapTable::filter(Handles *current_selection, const RecordMatcher &matcher) {
+    Handles *handles = new Handles();
+    SlottedPage *block = nullptr;
+    for (auto const &handle: *current_selection) {
+        if (block == nullptr || block->get_block_id() != handle.first) {
+            delete block;
+            block = nullptr;
+            if (!matcher.may_match(zone_map, handle.first))
+                continue;
+            block = file.get(handle.first);
+        }
+        SlottedPage *moved;
+        if (matcher.matches(locate(block, handle.second, moved)))
             handles->push_back(handle);
+        delete moved;
+    }
+    delete block;
     return handles;
 }
 
@@ -163,23 +350,60 @@ ValueDict *HeapTable::project(Handle handle) {
  * @return a sequence of values for handle given by column_names
  */
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
+    ColumnOrdinals ordinals = column_names->empty() ? this->all_columns : column_ordinals(column_names);
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    delete data;
+    SlottedPage *moved;
+    ValueDict *row = this->codec.unmarshal(locate(block, record_id, moved), ordinals);
+    delete moved;
     delete block;
-    if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict();
-    for (auto const &column_name: *column_names) {
-        if (row->find(column_name) == row->end())
-            throw DbRelationError("table does not have column named '" + column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
+    return row;
+}
+
+/**
+ * Project given columns from each of a list of rows.
+ * Consecutive handles in the same block share one fetch of that block.
+ * @param handles       rows to be projected
+ * @param column_names  columns to be included in the results (all of them if empty)
+ * @param arena         where to make the results (nullptr for the heap)
+ * @return              a sequence of values for each handle, in the order of handles
+ */
+ValueDicts *HeapTable::project(Handles *handles, const ColumnNames *column_names, Arena *arena) {
+    ColumnOrdinals ordinals = column_names->empty() ? this->all_columns : column_ordinals(column_names);
+    ValueDicts *rows;
+    if (arena == nullptr)
+        rows = new ValueDicts();
+    else
+        rows = arena->make<ValueDicts>(ValueDicts::allocator_type(arena));
+    rows->reserve(handles->size());
+    SlottedPage *block = nullptr;
+    for (auto const &handle: *handles) {
+        if (block == nullptr || block->get_block_id() != handle.first) {
+            delete block;
+            block = file.get(handle.first);
+        }
+        SlottedPage *moved;
+        rows->push_back(this->codec.unmarshal(locate(block, handle.second, moved), ordinals, arena));
+        delete moved;
     }
-    delete row;
-    return result;
+    delete block;
+    return rows;
+}
+
+/**
+ * Figure out where each of the given columns sits in the row layout.
+ * @param column_names  columns to locate (duplicates are allowed)
+ * @return              sorted, distinct ordinals of the given columns
+ * @throws DbRelationError if the table does not have one of the columns
+ */
+ColumnOrdinals HeapTable::column_ordinals(const ColumnNames *column_names) const {
+    ColumnOrdinals ordinals;
+    for (auto const &column_name: *column_names)
+        ordinals.push_back(this->codec.ordinal(column_name));
+    sort(ordinals.begin(), ordinals.end());
+    ordinals.erase(unique(ordinals.begin(), ordinals.end()), ordinals.end());
+    return ordinals;
 }
 
 /**
@@ -204,28 +428,100 @@ ValueDict *HeapTable::validate(const ValueDict *row) const {
 
 /**
  * Appends a record to the file.
+ * The record is marshaled straight into its slot in the block.
  * @param row to be appended
  * @return handle of newly inserted row
  */
 Handle HeapTable::append(const ValueDict *row) {
-    Dbt *data = marshal(row);
+    u16 size = this->codec.size(row);
     SlottedPage *block = this->file.get(this->file.get_last_block_id());
     RecordID record_id;
     try {
-        record_id = block->add(data);
+        record_id = block->reserve(size);
     } catch (DbBlockNoRoomError &e) {
         // need a new block
         delete block;
         block = this->file.get_new();
-        record_id = block->add(data);
+        record_id = block->reserve(size);
+        this->zone_map.start(this->file.get_last_block_id());
     }
+    this->codec.marshal(row, block->locate(record_id));
+    this->zone_map.add(this->file.get_last_block_id(), block->locate(record_id));
     this->file.put(block);
     delete block;
-    delete[] (char *) data->get_data();
-    delete data;
     return Handle(this->file.get_last_block_id(), record_id);
 }
 
+/**
+ * Put a moved row's record at the end of the file, marked as MOVED (so scans leave it to its forward).
+ * @param data     the record
+ * @param home_id  the row's block (which has no room for it)
+ * @return         where it went
+ */
+Handle HeapTable::relocate(const Dbt &data, BlockID home_id) {
+    SlottedPage *block = nullptr;
+    RecordID record_id;
+    if (this->file.get_last_block_id() != home_id) {
+        block = this->file.get(this->file.get_last_block_id());
+        try {
+            record_id = block->add(&data);
+        } catch (DbBlockNoRoomError &e) {
+            delete block;
+            block = nullptr;
+        }
+    }
+    if (block == nullptr) {
+        block = this->file.get_new();
+        record_id = block->add(&data);
+    }
+    block->set_flags(record_id, SlottedPage::MOVED);
+    BlockID block_id = block->get_block_id();
+    this->file.put(block);
+    delete block;
+    return Handle(block_id, record_id);
+}
+
+/**
+ * Where a moved row went.
+ * @param block      the row's block
+ * @param record_id  the row's record, a FORWARD
+ * @return           the handle of its MOVED record
+ */
+Handle HeapTable::forward(SlottedPage *block, RecordID record_id) {
+    const char *address = block->locate(record_id);
+    Handle moved_to;
+    memcpy(&moved_to.first, address, sizeof(BlockID));
+    memcpy(&moved_to.second, address + sizeof(BlockID), sizeof(RecordID));
+    return moved_to;
+}
+
+/**
+ * The bytes of a row's record, following its forward if it has moved.
+ * @param block      the row's block
+ * @param record_id  the row's record
+ * @param moved      set to the block the row moved to (freed by caller), or nullptr if it hasn't
+ * @return           the record
+ */
+const char *HeapTable::locate(SlottedPage *block, RecordID record_id, SlottedPage *&moved) {
+    moved = nullptr;
+    if (!(block->get_flags(record_id) & SlottedPage::FORWARD))
+        return block->locate(record_id);
+    Handle moved_to = forward(block, record_id);
+    moved = this->file.get(moved_to.first);
+    return moved->locate(moved_to.second);
+}
+
+/**
+ * Delete a moved row's record.
+ * @param moved_to  where it is
+ */
+void HeapTable::remove(Handle moved_to) {
+    SlottedPage *block = this->file.get(moved_to.first);
+    block->del(moved_to.second);
+    this->file.put(block);
+    delete block;
+}
+
 /**
  * Figure out the bits to go into the file.
  * The caller is responsible for freeing the returned Dbt and its enclosed ret->get_data().
@@ -233,43 +529,10 @@ Handle HeapTable::append(const ValueDict *row) {
  * @return bits of the record as it should appear on disk
  */
 Dbt *HeapTable::marshal(const ValueDict *row) const {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
-
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("row too big to marshal");
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u_long size = value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("row too big to marshal");
-            *(u16 *) (bytes + offset) = size;
-            offset += sizeof(u16);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("row too big to marshal");
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
-        }
-    }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    u16 size = this->codec.size(row);
+    char *bytes = new char[size];
+    this->codec.marshal(row, bytes);
+    return new Dbt(bytes, size);
 }
 
 /**
@@ -278,48 +541,31 @@ Dbt *HeapTable::marshal(const ValueDict *row) const {
  * @return row data for the tuple
  */
 ValueDict *HeapTable::unmarshal(Dbt *data) const {
-    ValueDict *row = new ValueDict();
-    Value value;
-    char *bytes = (char *) data->get_data();
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        value.data_type = ca.get_data_type();
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u16 size = *(u16 *) (bytes + offset);
-            offset += sizeof(u16);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
-        }
-        (*row)[column_name] = value;
-    }
-    return row;
+    return unmarshal(data, this->all_columns);
+}
+
+/**
+ * Decode just the requested columns from the given bits gotten from the file.
+ * @param data      file data for the tuple
+ * @param ordinals  sorted, distinct positions of the columns to decode (see column_ordinals)
+ * @return          row data for the tuple, keyed by just the requested column names
+ */
+ValueDict *HeapTable::unmarshal(Dbt *data, const ColumnOrdinals &ordinals) const {
+    return this->codec.unmarshal((const char *) data->get_data(), ordinals);
 }
 
 /**
  * See if the row at the given handle satisfies the given where clause
- * @param handle  row to check
- * @param where   conditions to check
- * @return        true if conditions met, false otherwise
- */
-bool HeapTable::selected(Handle handle, const ValueDict *where) {
-    if (where == nullptr)
-        return true;
-    ValueDict *row = this->project(handle, where);
-    bool is_selected = *row == *where;
-    delete row;
+ * @param handle   row to check
+ * @param matcher  compiled conditions to check
+ * @return         true if conditions met, false otherwise
+ */
+bool HeapTable::selected(Handle handle, const RecordMatcher &matcher) {
+    SlottedPage *block = file.get(handle.first);
+    SlottedPage *moved;
+    bool is_selected = matcher.matches(locate(block, handle.second, moved));
+    delete moved;
+    delete block;
     return is_selected;
 }
 
@@ -351,7 +597,7 @@ bool test_compare(DbRelation &table, Handle handle, int a, string b) {
         return false;
     }
     value = (*result)["b"];
-    if (value.s != b) {
+    if (value.s() != b) {
         delete result;
         return false;
     }
@@ -419,6 +665,33 @@ bool test_heap_storage() {
             return false;
     }
     cout << "many inserts/select/projects ok" << endl;
+
+    ColumnNames some_columns;
+    some_columns.push_back("c");
+    some_columns.push_back("a");
+    ValueDict *some = table.project(handles->back(), &some_columns);
+    if (some->size() != 2 || some->find("b") != some->end() || some->at("a").n != 999 || some->at("c").n != 0) {
+        delete some;
+        return false;
+    }
+    delete some;
+    cout << "project some columns ok" << endl;
+    delete handles;
+
+    ValueDict where;
+    where["a"] = Value(500);
+    where["b"] = Value(b);
+    where["c"] = Value(true);
+    where["c"].data_type = ColumnAttribute::BOOLEAN;
+    handles = table.select(&where);
+    if (handles->size() != 1 || !test_compare(table, handles->back(), 500, b))
+        return false;
+    where["a"] = Value(501);
+    Handles *refined = table.select(handles, &where);
+    if (!refined->empty())
+        return false;
+    delete refined;
+    cout << "select where ok" << endl;
     delete handles;
 
     table.del(last_handle);
@@ -431,7 +704,90 @@ bool test_heap_storage() {
             return false;
     }
     cout << "del ok" << endl;
-    table.drop();
     delete handles;
+
+    // the scans above summarized the blocks; appends widen the summary of the last one
+    Conjunction tail;
+    tail.push_back(Condition("a", Condition::GE, Value(990)));
+    handles = table.select(tail);
+    if (handles->size() != 9)  // 999 was deleted
+        return false;
+    delete handles;
+    test_set_row(row, 5000, b);
+    table.insert(&row);
+    handles = table.select(tail);
+    if (handles->size() != 10 || !test_compare(table, handles->back(), 5000, b))
+        return false;
+    delete handles;
+    Conjunction missing;
+    missing.push_back(Condition("b", Condition::EQ, Value("no such b")));
+    handles = table.select(missing);
+    if (!handles->empty())
+        return false;
+    delete handles;
+    cout << "zone maps ok" << endl;
+
+    handles = table.select(tail, 3);
+    if (handles->size() != 3 || !test_compare(table, handles->back(), 992, b))
+        return false;
+    delete handles;
+    handles = table.select(Conjunction(), 5);
+    if (handles->size() != 5 || !test_compare(table, handles->front(), -1, b))
+        return false;
+    delete handles;
+    cout << "select with limit ok" << endl;
+
+    // an update that fits stays put; one that doesn't moves the row but keeps its handle
+    Conjunction first;
+    first.push_back(Condition("a", Condition::EQ, Value(0)));
+    handles = table.select(first);
+    if (handles->size() != 1)
+        return false;
+    Handle moving = handles->front();
+    delete handles;
+    ValueDict new_values;
+    new_values["a"] = Value(-2);
+    table.update(moving, &new_values);
+    if (!test_compare(table, moving, -2, b))
+        return false;
+    string longer = b + b + b + b + b;
+    new_values["b"] = Value(longer);
+    table.update(moving, &new_values);
+    if (!test_compare(table, moving, -2, longer) || table.count() != 1001)
+        return false;
+    Conjunction moved;
+    moved.push_back(Condition("b", Condition::EQ, Value(longer)));
+    handles = table.select(moved);
+    if (handles->size() != 1 || handles->front() != moving)
+        return false;
+    delete handles;
+    new_values["b"] = Value(longer + b);
+    table.update(moving, &new_values);  // rewritten where it moved to (or moved again)
+    new_values["b"] = Value(b);
+    table.update(moving, &new_values);  // back home
+    handles = table.select();
+    if (handles->size() != 1001 || !test_compare(table, moving, -2, b))
+        return false;
+    delete handles;
+    new_values["b"] = Value(longer);
+    table.update(moving, &new_values);
+    table.del(moving);
+    handles = table.select(moved);
+    if (!handles->empty() || table.count() != 1000)
+        return false;
+    delete handles;
+    cout << "update ok" << endl;
+
+    table.truncate();
+    handles = table.select();
+    if (!handles->empty() || table.count() != 0)
+        return false;
+    delete handles;
+    test_set_row(row, 12, b);
+    Handle handle = table.insert(&row);
+    if (table.count() != 1 || !test_compare(table, handle, 12, b))
+        return false;
+    cout << "truncate ok" << endl;
+    table.drop();
     return true;
 }
\ No newline at end of file
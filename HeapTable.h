@@ -10,6 +10,7 @@
 #include "storage_engine.h"
 #include "SlottedPage.h"
 #include "HeapFile.h"
+#include "RecordCodec.h"
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
@@ -51,24 +52,55 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual Handles *select(const Conjunction &where);
+
+    virtual Handles *select(Handles *current_selection, const Conjunction &where);
+
+    virtual Handles *select(const Conjunction &where, size_t limit);
+
+    virtual size_t count();
+
+    virtual void truncate();
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names, Arena *arena = nullptr);
+
     using DbRelation::project;
 
 protected:
     HeapFile file;
+    ColumnOrdinals all_columns;
+    RecordCodec codec;
+    ZoneMap zone_map;
 
     virtual ValueDict *validate(const ValueDict *row) const;
 
     virtual Handle append(const ValueDict *row);
 
+    virtual Handle relocate(const Dbt &data, BlockID home_id);
+
+    static Handle forward(SlottedPage *block, RecordID record_id);
+
+    virtual const char *locate(SlottedPage *block, RecordID record_id, SlottedPage *&moved);
+
+    virtual void remove(Handle moved_to);
+
     virtual Dbt *marshal(const ValueDict *row) const;
 
     virtual ValueDict *unmarshal(Dbt *data) const;
 
-    virtual bool selected(Handle handle, const ValueDict *where);
+    virtual ValueDict *unmarshal(Dbt *data, const ColumnOrdinals &ordinals) const;
+
+    virtual ColumnOrdinals column_ordinals(const ColumnNames *column_names) const;
+
+    virtual Handles *scan(const RecordMatcher &matcher, size_t limit = (size_t) -1);
+
+    virtual Handles *filter(Handles *current_selection, const RecordMatcher &matcher);
+
+    virtual bool selected(Handle handle, const RecordMatcher &matcher);
 };
 
 bool test_heap_storage();
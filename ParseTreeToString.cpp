@@ -83,20 +83,37 @@ string ParseTreeToString::operator_expression(const Expr *expr) {
         case Expr::NONE:
             break;
         case Expr::BETWEEN:
+            ret += "BETWEEN";
+            if (expr->exprList != NULL && expr->exprList->size() == 2)
+                ret += " " + expression(expr->exprList->at(0)) + " AND " + expression(expr->exprList->at(1));
             break;
         case Expr::CASE:
             break;
         case Expr::NOT_EQUALS:
+            ret += "<>";
             break;
         case Expr::LESS_EQ:
+            ret += "<=";
             break;
         case Expr::GREATER_EQ:
+            ret += ">=";
             break;
         case Expr::LIKE:
             break;
         case Expr::NOT_LIKE:
             break;
         case Expr::IN:
+            ret += "IN (";
+            if (expr->exprList != NULL) {
+                bool doComma = false;
+                for (Expr *item: *expr->exprList) {
+                    if (doComma)
+                        ret += ", ";
+                    ret += expression(item);
+                    doComma = true;
+                }
+            }
+            ret += ")";
             break;
         case Expr::NOT:
             break;
@@ -136,11 +153,14 @@ string ParseTreeToString::expression(const Expr *expr) {
             ret += to_string(expr->ival);
             break;
         case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+            ret += string(expr->name) + "(" + (expr->distinct ? "DISTINCT " : "") + expression(expr->expr) + ")";
             break;
         case kExprOperator:
             ret += operator_expression(expr);
             break;
+        case kExprPlaceholder:
+            ret += "?";
+            break;
         default:
             ret += "???";
             break;
@@ -219,6 +239,8 @@ string ParseTreeToString::column_definition(const ColumnDefinition *col) {
 
 string ParseTreeToString::select(const SelectStatement *stmt) {
     string ret("SELECT ");
+    if (stmt->selectDistinct)
+        ret += "DISTINCT ";
     bool doComma = false;
     for (Expr *expr : *stmt->selectList) {
         if (doComma)
@@ -229,6 +251,36 @@ string ParseTreeToString::select(const SelectStatement *stmt) {
     ret += " FROM " + table_ref(stmt->fromTable);
     if (stmt->whereClause != NULL)
         ret += " WHERE " + expression(stmt->whereClause);
+    if (stmt->groupBy != NULL) {
+        ret += " GROUP BY ";
+        doComma = false;
+        for (Expr *expr : *stmt->groupBy->columns) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(expr);
+            doComma = true;
+        }
+        if (stmt->groupBy->having != NULL)
+            ret += " HAVING " + expression(stmt->groupBy->having);
+    }
+    if (stmt->order != NULL) {
+        ret += " ORDER BY ";
+        doComma = false;
+        for (OrderDescription *order : *stmt->order) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(order->expr);
+            if (order->type == kOrderDesc)
+                ret += " DESC";
+            doComma = true;
+        }
+    }
+    if (stmt->limit != NULL) {
+        if (stmt->limit->limit >= 0)
+            ret += " LIMIT " + to_string(stmt->limit->limit);
+        if (stmt->limit->offset > 0)
+            ret += " OFFSET " + to_string(stmt->limit->offset);
+    }
     return ret;
 }
 
@@ -303,6 +355,8 @@ string ParseTreeToString::drop(const DropStatement *stmt) {
         case DropStatement::kIndex:
             ret += string("INDEX ") + stmt->indexName + " FROM ";
             break;
+        case DropStatement::kPreparedStatement:
+            return string("DEALLOCATE PREPARE ") + stmt->name;
         default:
             ret += "? ";
     }
@@ -339,6 +393,48 @@ string ParseTreeToString::del(const DeleteStatement *stmt) {
     return ret;
 }
 
+string ParseTreeToString::update(const UpdateStatement *stmt) {
+    string ret("UPDATE ");
+    ret += table_ref(stmt->table) + " SET ";
+    bool doComma = false;
+    for (UpdateClause *clause : *stmt->updates) {
+        if (doComma)
+            ret += ", ";
+        ret += string(clause->column) + " = " + expression(clause->value);
+        doComma = true;
+    }
+    if (stmt->where != NULL) {
+        ret += " WHERE ";
+        ret += expression(stmt->where);
+    }
+    return ret;
+}
+
+string ParseTreeToString::prepare(const PrepareStatement *stmt) {
+    string ret("PREPARE ");
+    ret += stmt->name;
+    if (stmt->query != NULL && stmt->query->size() == 1)
+        ret += " FROM " + statement(stmt->query->getStatement(0));
+    return ret;
+}
+
+string ParseTreeToString::execute(const ExecuteStatement *stmt) {
+    string ret("EXECUTE ");
+    ret += stmt->name;
+    if (stmt->parameters != NULL) {
+        ret += "(";
+        bool doComma = false;
+        for (Expr *expr : *stmt->parameters) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(expr);
+            doComma = true;
+        }
+        ret += ")";
+    }
+    return ret;
+}
+
 string ParseTreeToString::statement(const SQLStatement *stmt) {
     switch (stmt->type()) {
         case kStmtSelect:
@@ -347,6 +443,12 @@ string ParseTreeToString::statement(const SQLStatement *stmt) {
             return insert((const InsertStatement *) stmt);
         case kStmtDelete:
             return del((const DeleteStatement *) stmt);
+        case kStmtUpdate:
+            return update((const UpdateStatement *) stmt);
+        case kStmtPrepare:
+            return prepare((const PrepareStatement *) stmt);
+        case kStmtExecute:
+            return execute((const ExecuteStatement *) stmt);
         case kStmtCreate:
             return create((const CreateStatement *) stmt);
         case kStmtDrop:
@@ -356,9 +458,6 @@ string ParseTreeToString::statement(const SQLStatement *stmt) {
 
         case kStmtError:
         case kStmtImport:
-        case kStmtUpdate:
-        case kStmtPrepare:
-        case kStmtExecute:
         case kStmtExport:
         case kStmtRename:
         case kStmtAlter:
@@ -45,6 +45,12 @@ private:
 
     static std::string del(const hsql::DeleteStatement *stmt);
 
+    static std::string update(const hsql::UpdateStatement *stmt);
+
+    static std::string prepare(const hsql::PrepareStatement *stmt);
+
+    static std::string execute(const hsql::ExecuteStatement *stmt);
+
     static std::string create(const hsql::CreateStatement *stmt);
 
     static std::string drop(const hsql::DropStatement *stmt);
@@ -0,0 +1,373 @@
+/**
+ * @file RecordCodec.cpp - implementation of RecordCodec, ZoneMap and RecordMatcher
+ * @see "Seattle University, CPSC5300, Spring 2020"
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "RecordCodec.h"
+
+using namespace std;
+typedef uint16_t u16;
+
+/**
+ * Constructor -- work out the field operations for the given schema.
+ * @param column_names       columns of the relation, in record order
+ * @param column_attributes  corresponding data types
+ */
+RecordCodec::RecordCodec(const ColumnNames &column_names, const ColumnAttributes &column_attributes) : ops(),
+                                                                                                     first_variable(0),
+                                                                                                     fixed_prefix(0) {
+    int offset = 0;
+    for (uint col_num = 0; col_num < column_names.size(); col_num++) {
+        ColumnAttribute ca = column_attributes[col_num];
+        FieldOp op = {column_names[col_num], ca.get_data_type(), offset};
+        this->ops.push_back(op);
+        if (offset < 0)
+            continue;
+        switch (op.data_type) {
+            case ColumnAttribute::DataType::INT:
+                offset += sizeof(int32_t);
+                break;
+            case ColumnAttribute::DataType::BOOLEAN:
+                offset += sizeof(uint8_t);
+                break;
+            case ColumnAttribute::DataType::TEXT:
+                this->first_variable = col_num;
+                this->fixed_prefix = (u16) offset;
+                offset = -1;
+                break;
+            default:
+                throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
+        }
+    }
+    if (offset >= 0) {
+        this->first_variable = (uint) this->ops.size();
+        this->fixed_prefix = (u16) offset;
+    }
+}
+
+// Width of a field of the given type (TEXT needs the field itself to read its length prefix).
+u16 RecordCodec::width(ColumnAttribute::DataType data_type, const char *field) {
+    if (data_type == ColumnAttribute::DataType::INT)
+        return sizeof(int32_t);
+    if (data_type == ColumnAttribute::DataType::BOOLEAN)
+        return sizeof(uint8_t);
+    return (u16) (sizeof(u16) + *(u16 *) field);
+}
+
+u16 RecordCodec::size(const ValueDict *row) const {
+    uint size = this->fixed_prefix;
+    for (uint col_num = this->first_variable; col_num < this->ops.size(); col_num++) {
+        const FieldOp &op = this->ops[col_num];
+        if (op.data_type == ColumnAttribute::DataType::TEXT) {
+            ValueDict::const_iterator column = row->find(op.column_name);
+            if (column == row->end())
+                throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+            size += sizeof(u16) + column->second.text_size();
+        } else {
+            size += width(op.data_type, nullptr);
+        }
+        if (size > DbBlock::BLOCK_SZ)
+            throw DbRelationError("row too big to marshal");
+    }
+    for (uint col_num = 0; col_num < this->first_variable; col_num++)
+        if (row->find(this->ops[col_num].column_name) == row->end())
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+    return (u16) size;
+}
+
+void RecordCodec::marshal(const ValueDict *row, char *bytes) const {
+    uint offset = 0;
+    for (auto const &op: this->ops) {
+        const Value &value = row->find(op.column_name)->second;
+        if (op.fixed_offset >= 0)
+            offset = (uint) op.fixed_offset;
+        switch (op.data_type) {
+            case ColumnAttribute::DataType::INT:
+                *(int32_t *) (bytes + offset) = value.n;
+                offset += sizeof(int32_t);
+                break;
+            case ColumnAttribute::DataType::BOOLEAN:
+                *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
+                offset += sizeof(uint8_t);
+                break;
+            default: {
+                u16 length = value.text_size();
+                *(u16 *) (bytes + offset) = length;
+                offset += sizeof(u16);
+                memcpy(bytes + offset, value.text_data(), length); // assume ascii for now
+                offset += length;
+            }
+        }
+    }
+}
+
+ValueDict *RecordCodec::unmarshal(const char *bytes, const ColumnOrdinals &ordinals, Arena *arena) const {
+    ValueDict *row;
+    if (arena == nullptr)
+        row = new ValueDict();
+    else
+        row = arena->make<ValueDict>(ValueDict::allocator_type(arena));
+    uint walked = this->first_variable;  // TEXT columns are found by walking forward from here
+    u16 offset = this->fixed_prefix;
+    for (auto const col_num: ordinals) {
+        const FieldOp &op = this->ops[col_num];
+        const char *field;
+        if (op.fixed_offset >= 0) {
+            field = bytes + op.fixed_offset;
+        } else {
+            for (; walked < col_num; walked++)
+                offset += width(this->ops[walked].data_type, bytes + offset);
+            field = bytes + offset;
+        }
+        Value &value = (*row)[op.column_name];
+        switch (op.data_type) {
+            case ColumnAttribute::DataType::INT:
+                value.n = *(int32_t *) field;
+                break;
+            case ColumnAttribute::DataType::BOOLEAN:
+                value.data_type = op.data_type;
+                value.n = *(uint8_t *) field;
+                break;
+            default:
+                value = Value(field + sizeof(u16), *(u16 *) field, arena);  // assume ascii for now
+        }
+    }
+    return row;
+}
+
+u16 RecordCodec::field_offset(const char *bytes, uint col_num) const {
+    const FieldOp &op = this->ops[col_num];
+    if (op.fixed_offset >= 0)
+        return (u16) op.fixed_offset;
+    u16 offset = this->fixed_prefix;
+    for (uint walked = this->first_variable; walked < col_num; walked++)
+        offset += width(this->ops[walked].data_type, bytes + offset);
+    return offset;
+}
+
+uint RecordCodec::ordinal(const Identifier &column_name) const {
+    for (uint col_num = 0; col_num < this->ops.size(); col_num++)
+        if (this->ops[col_num].column_name == column_name)
+            return col_num;
+    throw DbRelationError("table does not have column named '" + column_name + "'");
+}
+
+
+ZoneMap::ZoneMap(const RecordCodec &codec) : codec(codec), slots(), ordered_columns(0), text_columns(0), zones() {
+    for (uint col_num = 0; col_num < codec.column_count(); col_num++)
+        if (codec.get_data_type(col_num) == ColumnAttribute::DataType::TEXT)
+            this->slots.push_back((int) this->text_columns++);
+        else
+            this->slots.push_back((int) this->ordered_columns++);
+}
+
+void ZoneMap::start(BlockID block_id) {
+    if (block_id >= this->zones.size())
+        this->zones.resize(block_id + 1);
+    Zone &zone = this->zones[block_id];
+    zone.summarized = true;
+    zone.count = 0;
+    zone.least.assign(this->ordered_columns, INT32_MAX);
+    zone.greatest.assign(this->ordered_columns, INT32_MIN);
+    zone.blooms.assign(this->text_columns, Bloom());
+}
+
+void ZoneMap::add(BlockID block_id, const char *record) {
+    if (!summarized(block_id))
+        return;
+    Zone &zone = this->zones[block_id];
+    zone.count++;
+    for (uint col_num = 0; col_num < this->slots.size(); col_num++) {
+        const char *field = record + this->codec.field_offset(record, col_num);
+        int slot = this->slots[col_num];
+        switch (this->codec.get_data_type(col_num)) {
+            case ColumnAttribute::DataType::TEXT: {
+                uint32_t h = hash(field + sizeof(u16), *(u16 *) field);
+                zone.blooms[slot].set(h % BLOOM_BITS);
+                zone.blooms[slot].set((h >> 16) % BLOOM_BITS);
+                break;
+            }
+            default: {
+                int32_t n = this->codec.get_data_type(col_num) == ColumnAttribute::DataType::INT ? *(int32_t *) field
+                                                                                                   : *(uint8_t *) field;
+                zone.least[slot] = min(zone.least[slot], n);
+                zone.greatest[slot] = max(zone.greatest[slot], n);
+            }
+        }
+    }
+}
+
+// FNV-1a
+uint32_t ZoneMap::hash(const char *chars, uint size) {
+    uint32_t h = 2166136261u;
+    for (uint i = 0; i < size; i++)
+        h = (h ^ (unsigned char) chars[i]) * 16777619u;
+    return h;
+}
+
+bool ZoneMap::may_contain(const Bloom &bloom, const Value &value) {
+    uint32_t h = hash(value.text_data(), value.text_size());
+    return bloom.test(h % BLOOM_BITS) && bloom.test((h >> 16) % BLOOM_BITS);
+}
+
+
+/**
+ * Compile a where clause for the given record layout.
+ * @param codec  layout of the relation's records
+ * @param where  equality conditions (nullptr matches everything)
+ * @throws DbRelationError if where names a column the relation does not have
+ */
+RecordMatcher::RecordMatcher(const RecordCodec &codec, const ValueDict *where) : codec(codec), fixed_tests(),
+                                                                                 variable_tests(), impossible(false) {
+    compile(Condition::equalities(where));
+}
+
+/**
+ * Compile a where clause for the given record layout.
+ * @param codec  layout of the relation's records
+ * @param where  comparisons that must all hold
+ * @throws DbRelationError if where names a column the relation does not have
+ */
+RecordMatcher::RecordMatcher(const RecordCodec &codec, const Conjunction &where) : codec(codec), fixed_tests(),
+                                                                                   variable_tests(), impossible(false) {
+    compile(where);
+}
+
+void RecordMatcher::compile(const Conjunction &where) {
+    for (auto const &condition: where) {
+        uint col_num = codec.ordinal(condition.column_name);
+        FieldTest test = {col_num, codec.get_data_type(col_num), codec.fixed_offset(col_num), condition.comparison,
+                          std::vector<Value>()};
+        // a comparison with a value of another data type never holds (an IN just drops such values)
+        for (auto const &operand: condition.operands)
+            if (operand.data_type == test.data_type)
+                test.operands.push_back(operand);
+            else if (condition.comparison != Condition::IN)
+                this->impossible = true;
+        if (test.operands.empty())
+            this->impossible = true;
+        if (test.fixed_offset >= 0)
+            this->fixed_tests.push_back(test);
+        else
+            this->variable_tests.push_back(test);
+    }
+    sort(this->variable_tests.begin(), this->variable_tests.end(),
+         [](const FieldTest &a, const FieldTest &b) { return a.col_num < b.col_num; });
+}
+
+/**
+ * Check a marshaled record against the compiled conditions.
+ * @param bytes  the record
+ * @return       true if every condition holds
+ */
+bool RecordMatcher::matches(const char *bytes) const {
+    if (this->impossible)
+        return false;
+    for (auto const &test: this->fixed_tests)
+        if (!field_matches(bytes + test.fixed_offset, test))
+            return false;
+    for (auto const &test: this->variable_tests)
+        if (!field_matches(bytes + this->codec.field_offset(bytes, test.col_num), test))
+            return false;
+    return true;
+}
+
+bool RecordMatcher::may_match(const ZoneMap &zone_map, BlockID block_id) const {
+    if (this->impossible)
+        return false;
+    if (!zone_map.summarized(block_id))
+        return true;
+    const ZoneMap::Zone &zone = zone_map.zones[block_id];
+    if (zone.count == 0)
+        return false;
+    for (auto const &test: this->fixed_tests)
+        if (!zone_may_match(zone, zone_map.slots[test.col_num], test))
+            return false;
+    for (auto const &test: this->variable_tests)
+        if (!zone_may_match(zone, zone_map.slots[test.col_num], test))
+            return false;
+    return true;
+}
+
+// Check a test against the summary of one column of a block.
+bool RecordMatcher::zone_may_match(const ZoneMap::Zone &zone, int slot, const FieldTest &test) {
+    if (test.data_type == ColumnAttribute::DataType::TEXT) {
+        if (test.comparison != Condition::EQ && test.comparison != Condition::IN)
+            return true;  // the bloom filter only knows about equality
+        for (auto const &operand: test.operands)
+            if (ZoneMap::may_contain(zone.blooms[slot], operand))
+                return true;
+        return false;
+    }
+    int32_t least = zone.least[slot], greatest = zone.greatest[slot];
+    switch (test.comparison) {
+        case Condition::LT:
+            return least < test.operands[0].n;
+        case Condition::LE:
+            return least <= test.operands[0].n;
+        case Condition::GT:
+            return greatest > test.operands[0].n;
+        case Condition::GE:
+            return greatest >= test.operands[0].n;
+        case Condition::BETWEEN:
+            return least <= test.operands[1].n && greatest >= test.operands[0].n;
+        default:  // EQ, IN
+            for (auto const &operand: test.operands)
+                if (least <= operand.n && operand.n <= greatest)
+                    return true;
+            return false;
+    }
+}
+
+// Check one marshaled field against the test's comparison.
+bool RecordMatcher::field_matches(const char *field, const FieldTest &test) {
+    if (test.comparison == Condition::EQ && test.data_type == ColumnAttribute::DataType::TEXT) {
+        u16 size = *(u16 *) field;  // unequal lengths settle most TEXT equalities without comparing characters
+        return size == test.operands[0].text_size() &&
+               memcmp(field + sizeof(u16), test.operands[0].text_data(), size) == 0;
+    }
+    switch (test.comparison) {
+        case Condition::EQ:
+            return field_compare(field, test.data_type, test.operands[0]) == 0;
+        case Condition::LT:
+            return field_compare(field, test.data_type, test.operands[0]) < 0;
+        case Condition::LE:
+            return field_compare(field, test.data_type, test.operands[0]) <= 0;
+        case Condition::GT:
+            return field_compare(field, test.data_type, test.operands[0]) > 0;
+        case Condition::GE:
+            return field_compare(field, test.data_type, test.operands[0]) >= 0;
+        case Condition::BETWEEN:
+            return field_compare(field, test.data_type, test.operands[0]) >= 0 &&
+                   field_compare(field, test.data_type, test.operands[1]) <= 0;
+        case Condition::IN:
+            for (auto const &operand: test.operands)
+                if (field_compare(field, test.data_type, operand) == 0)
+                    return true;
+            return false;
+        default:
+            throw DbRelationError("unknown comparison");
+    }
+}
+
+// Order a marshaled field against a value of the same data type (negative, zero, or positive, as for memcmp).
+int RecordMatcher::field_compare(const char *field, ColumnAttribute::DataType data_type, const Value &value) {
+    switch (data_type) {
+        case ColumnAttribute::DataType::INT: {
+            int32_t n = *(int32_t *) field;
+            return n < value.n ? -1 : n > value.n ? 1 : 0;
+        }
+        case ColumnAttribute::DataType::TEXT: {
+            u16 size = *(u16 *) field;
+            u16 common = size < value.text_size() ? size : value.text_size();
+            int cmp = memcmp(field + sizeof(u16), value.text_data(), common);
+            return cmp != 0 ? cmp : (int) size - (int) value.text_size();
+        }
+        case ColumnAttribute::DataType::BOOLEAN:
+            return (int) *(uint8_t *) field - value.n;
+        default:
+            throw DbRelationError("Only know how to match INT, TEXT, and BOOLEAN");
+    }
+}
@@ -0,0 +1,200 @@
+/**
+ * @file RecordCodec.h - Per-table record layout: marshaling and predicate matching.
+ * RecordCodec
+ * ZoneMap
+ * RecordMatcher
+ *
+ * @see "Seattle University, CPSC5300, Spring 2020"
+ */
+#pragma once
+
+#include <bitset>
+#include "storage_engine.h"
+
+/**
+ * @class RecordCodec - marshals rows of one relation to and from its on-disk record layout
+ *
+ * Records are laid out field by field in column order: INT as 4 bytes, BOOLEAN as 1 byte, and TEXT
+ * as a 2-byte length followed by the characters. The codec is built once for a relation and turns the
+ * schema into a list of field operations, so marshaling does not re-examine the ColumnAttributes for
+ * every field of every row. The leading fixed-width columns (those in front of the first TEXT column)
+ * always sit at the same offset and are read and written there directly.
+ */
+class RecordCodec {
+public:
+    RecordCodec(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~RecordCodec() {}
+
+    /**
+     * Number of bytes the given row will take when marshaled.
+     * @param row  values for every column
+     * @returns    size of the record
+     * @throws     DbRelationError if the row is missing a column or does not fit in a block
+     */
+    u_int16_t size(const ValueDict *row) const;
+
+    /**
+     * Write the given row into the given space.
+     * @param row    values for every column (already checked by size())
+     * @param bytes  where to put the record (must have room for size(row) bytes)
+     */
+    void marshal(const ValueDict *row, char *bytes) const;
+
+    /**
+     * Decode some of the columns from a record.
+     * @param bytes     the record
+     * @param ordinals  sorted, distinct positions of the columns to decode
+     * @param arena     where to make the row (nullptr for the heap)
+     * @returns         row data keyed by just the requested column names (freed by caller unless in an arena)
+     */
+    ValueDict *unmarshal(const char *bytes, const ColumnOrdinals &ordinals, Arena *arena = nullptr) const;
+
+    /**
+     * Byte offset of the given field within a record.
+     * @param bytes    the record
+     * @param col_num  position of the column
+     * @returns        offset of the field (past any earlier TEXT fields)
+     */
+    u_int16_t field_offset(const char *bytes, uint col_num) const;
+
+    /**
+     * Offset of the given column if it is the same for every record.
+     * @param col_num  position of the column
+     * @returns        the offset, or -1 if a TEXT column comes before it
+     */
+    int fixed_offset(uint col_num) const { return ops[col_num].fixed_offset; }
+
+    ColumnAttribute::DataType get_data_type(uint col_num) const { return ops[col_num].data_type; }
+
+    const Identifier &get_column_name(uint col_num) const { return ops[col_num].column_name; }
+
+    uint column_count() const { return (uint) ops.size(); }
+
+    /**
+     * Position of a column within the record.
+     * @param column_name  name of the column
+     * @returns            its ordinal
+     * @throws             DbRelationError if there is no such column
+     */
+    uint ordinal(const Identifier &column_name) const;
+
+protected:
+    struct FieldOp {
+        Identifier column_name;
+        ColumnAttribute::DataType data_type;
+        int fixed_offset;  // -1 once a TEXT column has been passed
+    };
+    std::vector<FieldOp> ops;
+    uint first_variable;        // ordinal of the first TEXT column (ops.size() if none)
+    u_int16_t fixed_prefix;     // bytes taken by the columns in front of first_variable
+
+    static u_int16_t width(ColumnAttribute::DataType data_type, const char *field);
+};
+
+
+/**
+ * @class ZoneMap - per-block summaries of a relation's records, so a scan can skip blocks that can't match
+ *
+ * For each block: the least and greatest value of each INT and BOOLEAN column, and a bloom filter of the
+ * values of each TEXT column. The summaries are only kept in memory. A block is summarized the first time a
+ * scan reads it (or when it is started by an append), widened as records are added to it, and left alone
+ * when records are deleted, so a summary may claim values the block no longer has but never misses one it
+ * does have.
+ */
+class ZoneMap {
+public:
+    explicit ZoneMap(const RecordCodec &codec);
+
+    virtual ~ZoneMap() {}
+
+    bool summarized(BlockID block_id) const {
+        return block_id < zones.size() && zones[block_id].summarized;
+    }
+
+    /**
+     * Begin the summary of a block (forgetting any earlier one); its records are then given to add().
+     * @param block_id  the block
+     */
+    void start(BlockID block_id);
+
+    /**
+     * Widen the summary of a block to cover another of its records (ignored if the block isn't summarized).
+     * @param block_id  the block
+     * @param record    the marshaled record
+     */
+    void add(BlockID block_id, const char *record);
+
+    void clear() { zones.clear(); }
+
+protected:
+    static const uint BLOOM_BITS = 512;
+    typedef std::bitset<BLOOM_BITS> Bloom;
+
+    struct Zone {
+        bool summarized;
+        uint count;                   // records added
+        std::vector<int32_t> least;   // by slot, for the INT and BOOLEAN columns
+        std::vector<int32_t> greatest;
+        std::vector<Bloom> blooms;    // by slot, for the TEXT columns
+    };
+    const RecordCodec &codec;
+    std::vector<int> slots;  // by column: where its summary is in Zone::least/greatest or Zone::blooms
+    uint ordered_columns;
+    uint text_columns;
+    std::vector<Zone> zones;  // by block id
+
+    static uint32_t hash(const char *chars, uint size);
+
+    static bool may_contain(const Bloom &bloom, const Value &value);
+
+    friend class RecordMatcher;
+};
+
+
+/**
+ * @class RecordMatcher - a where-clause conjunction compiled against a relation's record layout
+ *
+ * Each test knows the position and data type of its column, so a record can be checked in its
+ * marshaled form without being unmarshaled. Tests on columns at a fixed offset are checked first; the rest
+ * walk the TEXT length prefixes to find their field.
+ */
+class RecordMatcher {
+public:
+    RecordMatcher(const RecordCodec &codec, const ValueDict *where);
+
+    RecordMatcher(const RecordCodec &codec, const Conjunction &where);
+
+    virtual ~RecordMatcher() {}
+
+    bool matches(const char *bytes) const;
+
+    /**
+     * Check the compiled conditions against a block's summary.
+     * @param zone_map  the summaries
+     * @param block_id  the block
+     * @returns         false if no record in the block can match (true if it isn't summarized)
+     */
+    bool may_match(const ZoneMap &zone_map, BlockID block_id) const;
+
+protected:
+    struct FieldTest {
+        uint col_num;
+        ColumnAttribute::DataType data_type;
+        int fixed_offset;
+        Condition::Comparison comparison;
+        std::vector<Value> operands;  // all of the column's data type
+    };
+    const RecordCodec &codec;
+    std::vector<FieldTest> fixed_tests;
+    std::vector<FieldTest> variable_tests;  // in column order
+    bool impossible;  // some test compares a column against a value of another data type
+
+    void compile(const Conjunction &where);
+
+    static bool field_matches(const char *field, const FieldTest &test);
+
+    static bool zone_may_match(const ZoneMap::Zone &zone, int slot, const FieldTest &test);
+
+    static int field_compare(const char *field, ColumnAttribute::DataType data_type, const Value &value);
+};
@@ -3,9 +3,15 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2020"
  */
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <regex>
 #include "SQLExec.h"
 #include "ParseTreeToString.h"
 #include "EvalPlan.h"
+#include "btree.h"
 
 using namespace std;
 using namespace hsql;
@@ -13,6 +19,9 @@ using namespace hsql;
 // define static data
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
+map<Identifier, PreparedStatement *> SQLExec::prepared;
+SQLExec::StatementCache SQLExec::statement_cache;
+map<string, SQLExec::StatementCache::iterator> SQLExec::statement_cache_index;
 
 // make query result be printable
 ostream &operator<<(ostream &out, const QueryResult &qres) {
@@ -31,7 +40,7 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
                         out << value.n;
                         break;
                     case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
+                        out << "\"" << value << "\"";
                         break;
                     case ColumnAttribute::BOOLEAN:
                         out << (value.n == 0 ? "false" : "true");
@@ -53,7 +62,9 @@ QueryResult::~QueryResult() {
         delete column_names;
     if (column_attributes != nullptr)
         delete column_attributes;
-    if (rows != nullptr) {
+    if (arena != nullptr) {
+        delete arena;  // rows are in here
+    } else if (rows != nullptr) {
         for (auto row: *rows)
             delete row;
         delete rows;
@@ -61,33 +72,58 @@ QueryResult::~QueryResult() {
 }
 
 
-QueryResult *SQLExec::execute(const SQLStatement *statement) {
+QueryResult *SQLExec::execute(const SQLStatement *statement, const TableOptions *options) {
     // initialize _tables table, if not yet present
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
         SQLExec::indices = new Indices();
     }
 
+    // memory for the statement's results; handed over to the QueryResult if it uses it
+    Arena *arena = new Arena();
+    QueryResult *result;
     try {
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement *) statement);
+                result = create((const CreateStatement *) statement, options);
+                break;
             case kStmtDrop:
-                return drop((const DropStatement *) statement);
+                result = drop((const DropStatement *) statement);
+                break;
             case kStmtShow:
-                return show((const ShowStatement *) statement);
+                result = show((const ShowStatement *) statement);
+                break;
             case kStmtInsert:
-                return insert((const InsertStatement *) statement);
+                result = insert((const InsertStatement *) statement);
+                break;
             case kStmtDelete:
-                return del((const DeleteStatement *) statement);
+                result = del((const DeleteStatement *) statement);
+                break;
             case kStmtSelect:
-                return select((const SelectStatement *) statement);
+                result = select((const SelectStatement *) statement, arena);
+                break;
+            case kStmtUpdate:
+                result = update((const UpdateStatement *) statement);
+                break;
+            case kStmtPrepare:
+                result = prepare((const PrepareStatement *) statement);
+                break;
+            case kStmtExecute:
+                result = execute_prepared((const ExecuteStatement *) statement);
+                break;
             default:
-                return new QueryResult("not implemented");
+                result = new QueryResult("not implemented");
         }
     } catch (DbRelationError &e) {
+        delete arena;
         throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (...) {
+        delete arena;
+        throw;
     }
+    if (result->get_arena() != arena)
+        delete arena;
+    return result;
 }
 
 QueryResult *SQLExec::insert(const InsertStatement *statement) {
@@ -107,23 +143,17 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
 	else {
 		column_names = table.get_column_names();
 	}
+    if (statement->values->size() != column_names.size())
+        throw SQLExecError("expected " + to_string(column_names.size()) + " values, got " +
+                           to_string(statement->values->size()));
     vector<Value> records;
-	for (auto const record : *statement->values) {
-		switch (record->type) {
-		case kExprLiteralString:
-			records.push_back(Value(record->name));
-			break;
-		case kExprLiteralInt:
-			records.push_back(Value(record->ival));
-			break;
-		default:
-			throw DbRelationError("Unsupported Data type!");
-		}
-	}
+	for (u_int16_t i = 0; i < column_names.size(); i++)
+		records.push_back(column_value(table, column_names[i], statement->values->at(i)));
     
     uint size;
 	// hold handle for inserting row 
 	Handle record_handle;
+	bool inserted = false;
 	try {
 		ValueDict row;
 		Identifier column_name;
@@ -133,26 +163,31 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
 		}
 		// insert row to table
 		record_handle = table.insert(&row);
+		inserted = true;
 
 		// update index
 		IndexNames index_names = indices->get_index_names(table_name);
 		size = index_names.size();
+		u_int16_t indexed = 0;
 		try {
-			for (u_int16_t i = 0; i < index_names.size(); i++) {
-				DbIndex &index = indices->get_index(table_name, index_names[i]);
+			for (; indexed < index_names.size(); indexed++) {
+				DbIndex &index = indices->get_index(table_name, index_names[indexed]);
 				index.insert(record_handle);
 			}
 		}
 		catch (exception& e) {
-			for (u_int16_t i = 0; i < index_names.size(); i++) {
+			// back out of the indices it got into
+			for (u_int16_t i = 0; i < indexed; i++) {
 				DbIndex &index = indices->get_index(table_name, index_names[i]);
 				index.del(record_handle);
 			}
+			throw;
 		}
 	}
 	catch (exception& e) {
 		try {
-			table.del(record_handle);
+			if (inserted)
+				table.del(record_handle);
 		}
 		catch (...) {}
 		throw;
@@ -163,29 +198,21 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
 QueryResult *SQLExec::del(const DeleteStatement *statement) {
     Identifier table_name = statement->tableName;
     DbRelation &table = SQLExec::tables->get_table(table_name);
-    
-    //start base of plan at a TableScan
-    EvalPlan *plan = new EvalPlan(table);
-    //enclose that in a delete if we have a where clause
-    if(statement->expr != nullptr)
-        plan = new EvalPlan(fetch_where_clause(statement->expr), plan);
-    //optimize the plan
-    EvalPlan *optimized = plan->optimize();
-    EvalPipeline pipeline = optimized->pipeline();
-    delete plan;
-    delete optimized;
+    if (statement->expr == nullptr)
+        return truncate(table_name);
+    Handles *handles = victims(table_name, statement->expr);
 
-    // now delete all the handles
+    // take the rows out of each index, then out of the table
     IndexNames index_names = SQLExec::indices->get_index_names(table_name);
-	// to hold hanles from piepleline
-	Handles *handles = pipeline.second;
-	// iterate to delete index from index table
-	for (auto const &index_name : index_names) {
-		DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
-		for (auto const &handle : *handles) {
-			index.del(handle);
-		}
-	}
+    try {
+        for (auto const &index_name : index_names)
+            SQLExec::indices->get_index(table_name, index_name).del_batch(*handles);
+        for (auto const &handle : *handles)
+            table.del(handle);
+    } catch (...) {
+        delete handles;
+        throw;
+    }
 	// to hold suffix string statement for query result
 	string suffix;
 	// in case of no index deletion
@@ -194,58 +221,367 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
 	// in case of index/indices is/are deleted
 	else
 		suffix = " and " + to_string(index_names.size()) + " from indices";
-	// delete from table
-	for (auto const &handle : *handles) {
-		pipeline.first->del(handle);
-	}
 
     int size = handles->size();
     delete handles;
 	return new QueryResult("successfully deleted " + to_string(size) + " rows from " + table_name + suffix);
 }
 
-ValueDict *SQLExec::fetch_where_clause(const Expr *expr){
-    ValueDict *val = new ValueDict();
-    if(expr == NULL){
-        return val;
+// TRUNCATE TABLE (or DELETE FROM with no where clause): empty the table's file and each of its indices' files
+// in place, without visiting the rows.
+QueryResult *SQLExec::truncate(const Identifier &table_name) {
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    size_t size = table.count();
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    for (auto const &index_name : index_names)
+        SQLExec::indices->get_index(table_name, index_name).truncate();
+    table.truncate();
+    string suffix;
+    if (index_names.size() > 0)
+        suffix = " and " + to_string(index_names.size()) + " from indices";
+    return new QueryResult("successfully deleted " + to_string(size) + " rows from " + table_name + suffix);
+}
+
+// The rows of a DELETE or UPDATE: found by the same plan (and so the same index searches) as a SELECT's.
+Handles *SQLExec::victims(const Identifier &table_name, const Expr *where) {
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    DbIndexes table_indices;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name))
+        table_indices.push_back(&SQLExec::indices->get_index(table_name, index_name));
+    EvalPlan *plan = new EvalPlan(table, table_indices);
+    if (where != nullptr)
+        plan = new EvalPlan(fetch_where_clause(where), plan);
+    EvalPlan *optimized = plan->optimize();
+    delete plan;
+    EvalPipeline pipeline;
+    try {
+        pipeline = optimized->pipeline();
+    } catch (...) {
+        delete optimized;
+        throw;
+    }
+    delete optimized;
+    return pipeline.second;
+}
+
+// Rewrite the rows matching the where clause. An index is only touched if some of its key columns are being set:
+// its entries for the rows are taken out before the rows change and put back after.
+QueryResult *SQLExec::update(const UpdateStatement *statement) {
+    if (statement->table->type != kTableName)
+        throw SQLExecError("can only update one table");
+    Identifier table_name = statement->table->name;
+    if (!table_exist(table_name))
+        throw SQLExecError(table_name + " not exist");
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+
+    ValueDict new_values;
+    for (auto const &clause : *statement->updates) {
+        Identifier column_name = clause->column;
+        new_values[column_name] = column_value(table, column_name, clause->value);
     }
 
-    vector<Value>* res = new vector<Value>();
-    expression(expr, res);
-    for(int i = 0; i < (int)res->size(); i += 2){
-        (*val)[res->at(i).s] = res->at(i + 1);
+    Handles *handles = victims(table_name, statement->where);
+
+    // the indices on any of the columns being set
+    vector<DbIndex *> changed;
+    for (auto const &index_name : SQLExec::indices->get_index_names(table_name)) {
+        DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+        for (auto const &key_column : index.get_key_columns()) {
+            if (new_values.find(key_column) != new_values.end()) {
+                changed.push_back(&index);
+                break;
+            }
+        }
     }
-    delete res;
-    return val;
+    size_t taken = 0;       // changed indices whose entries for the rows have been taken out
+    size_t restored = 0;    // of those, the ones they have all been put back into
+    size_t reinserted = 0;  // rows put back into the next one
+    try {
+        for (; taken < changed.size(); taken++)
+            changed[taken]->del_batch(*handles);
+        for (auto const &handle : *handles)
+            table.update(handle, &new_values);
+        for (; restored < changed.size(); restored++, reinserted = 0)
+            for (; reinserted < handles->size(); reinserted++)
+                changed[restored]->insert(handles->at(reinserted));
+    } catch (...) {
+        // put back the entries still missing, for the rows as they now are
+        for (size_t i = restored; i < taken; i++) {
+            for (size_t j = i == restored ? reinserted : 0; j < handles->size(); j++) {
+                try {
+                    changed[i]->insert(handles->at(j));
+                } catch (...) {}
+            }
+        }
+        delete handles;
+        throw;
+    }
+
+    string suffix;
+    if (changed.size() > 0)
+        suffix = " and " + to_string(changed.size()) + " indices";
+    int size = handles->size();
+    delete handles;
+    return new QueryResult("successfully updated " + to_string(size) + " rows in " + table_name + suffix);
 }
 
-void SQLExec::operator_expression(const Expr *expr, vector<Value> *res){
-    expression(expr->expr, res);
-    if(expr->opType == Expr::SIMPLE_OP || expr->opType == Expr::AND){
-        // for now, only support AND & EQUAL op
-    } else {
+Conjunction *SQLExec::fetch_where_clause(const Expr *expr) {
+    Conjunction *where = new Conjunction();
+    if (expr == nullptr)
+        return where;
+    try {
+        conjunction(expr, *where);
+    } catch (...) {
+        delete where;
+        throw;
+    }
+    return where;
+}
+
+// Add the comparisons in expr to where: <column> <op> <literal> (or the other way round) for =, <, <=, >, >=,
+// <column> BETWEEN <literal> AND <literal>, and <column> IN (<literals>), joined by AND.
+void SQLExec::conjunction(const Expr *expr, Conjunction &where) {
+    if (expr->type != kExprOperator)
+        throw SQLExecError("not support this where clause");
+    if (expr->opType == Expr::AND) {
+        conjunction(expr->expr, where);
+        conjunction(expr->expr2, where);
+        return;
+    }
+    if (expr->opType == Expr::BETWEEN || expr->opType == Expr::IN) {
+        if (expr->expr->type != kExprColumnRef || expr->exprList == nullptr)
+            throw SQLExecError("not support this op");
+        vector<Value> operands;
+        for (auto const operand: *expr->exprList)
+            operands.push_back(literal(operand));
+        if (expr->opType == Expr::BETWEEN && operands.size() != 2)
+            throw SQLExecError("BETWEEN needs a low and a high value");
+        where.push_back(Condition(expr->expr->name, expr->opType == Expr::BETWEEN ? Condition::BETWEEN : Condition::IN,
+                                  operands));
+        return;
+    }
+
+    Condition::Comparison comparison;
+    if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=')
+        comparison = Condition::EQ;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '<')
+        comparison = Condition::LT;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '>')
+        comparison = Condition::GT;
+    else if (expr->opType == Expr::LESS_EQ)
+        comparison = Condition::LE;
+    else if (expr->opType == Expr::GREATER_EQ)
+        comparison = Condition::GE;
+    else
         throw SQLExecError("not support this op");
+    if (expr->expr->type == kExprColumnRef) {
+        where.push_back(Condition(expr->expr->name, comparison, literal(expr->expr2)));
+    } else if (expr->expr2->type == kExprColumnRef) {
+        // <literal> <op> <column>: turn it around
+        if (comparison == Condition::LT)
+            comparison = Condition::GT;
+        else if (comparison == Condition::GT)
+            comparison = Condition::LT;
+        else if (comparison == Condition::LE)
+            comparison = Condition::GE;
+        else if (comparison == Condition::GE)
+            comparison = Condition::LE;
+        where.push_back(Condition(expr->expr2->name, comparison, literal(expr->expr)));
+    } else {
+        throw SQLExecError("a comparison needs a column on one side");
+    }
+}
+
+Value SQLExec::literal(const Expr *expr) {
+    if (expr->type == kExprLiteralString)
+        return Value(expr->name);
+    if (expr->type == kExprLiteralInt)
+        return Value((int32_t) expr->ival);
+    throw SQLExecError("not support this op");
+}
+
+// INT and BOOLEAN columns take integers, TEXT columns take strings.
+Value SQLExec::column_value(const DbRelation &table, const Identifier &column_name, const Expr *expr) {
+    const ColumnNames &column_names = table.get_column_names();
+    auto found = find(column_names.begin(), column_names.end(), column_name);
+    if (found == column_names.end())
+        throw SQLExecError("unknown column " + column_name);
+    ColumnAttribute attribute = table.get_column_attributes()[found - column_names.begin()];
+    Value value = literal(expr);
+    bool text = attribute.get_data_type() == ColumnAttribute::TEXT;
+    if (text != (value.data_type == ColumnAttribute::TEXT))
+        throw SQLExecError("column " + column_name + " takes " + (text ? "TEXT" : "INT") + " values");
+    return value;
+}
+
+
+// The column an ORDER BY item sorts by.
+static const Expr *order_column(const OrderDescription *order) {
+    if (order->expr->type != kExprColumnRef)
+        throw SQLExecError("ORDER BY only supports columns");
+    return order->expr;
+}
+
+// Put a SELECT's rows in its ORDER BY order (if given a sort order) and keep those its LIMIT and OFFSET ask for:
+// a TopN when there is both, otherwise a Sort and/or a Limit.
+// For SELECT DISTINCT, the plan must give just the result columns. The duplicates are dropped after the sort and
+// before the limit; the sort goes on to the rest of the columns, which puts the duplicates next to each other.
+static EvalPlan *order_and_limit(const SelectStatement *statement, SortOrder *sort_order, EvalPlan *plan) {
+    size_t limit = EvalPlan::NO_LIMIT, offset = 0;
+    if (statement->limit != nullptr) {
+        if (statement->limit->limit >= 0)
+            limit = (size_t) statement->limit->limit;
+        if (statement->limit->offset > 0)
+            offset = (size_t) statement->limit->offset;
     }
-    if(expr->expr2 != NULL){
-        expression(expr->expr2, res);
+    if (statement->selectDistinct) {
+        if (sort_order != nullptr) {
+            ColumnNames column_names;
+            ColumnAttributes column_attributes;
+            plan->get_columns(column_names, column_attributes);
+            ColumnNames sorted;
+            for (auto const &column: *sort_order) {
+                if (find(column_names.begin(), column_names.end(), column.first) == column_names.end()) {
+                    SQLExecError error("for SELECT DISTINCT, ORDER BY column '" + column.first +
+                                       "' must be in the select list");
+                    delete sort_order;
+                    delete plan;
+                    throw error;
+                }
+                sorted.push_back(column.first);
+            }
+            for (auto const &column_name: column_names) {
+                if (find(sorted.begin(), sorted.end(), column_name) == sorted.end()) {
+                    sort_order->push_back(make_pair(column_name, false));
+                    sorted.push_back(column_name);
+                }
+            }
+            plan = new EvalPlan(sort_order, plan);
+        }
+        plan = new EvalPlan(EvalPlan::Distinct, plan);
+        if (limit != EvalPlan::NO_LIMIT || offset > 0)
+            plan = new EvalPlan(limit, offset, plan);
+        return plan;
     }
+    if (sort_order != nullptr && limit != EvalPlan::NO_LIMIT)
+        return new EvalPlan(sort_order, limit, offset, plan);
+    if (sort_order != nullptr)
+        plan = new EvalPlan(sort_order, plan);
+    if (limit != EvalPlan::NO_LIMIT || offset > 0)
+        plan = new EvalPlan(limit, offset, plan);
+    return plan;
+}
+
+// Whether a SELECT aggregates: it has GROUP BY or an aggregate function in its select list.
+static bool aggregating(const SelectStatement *statement) {
+    if (statement->groupBy != nullptr)
+        return true;
+    for (auto const expr: *statement->selectList)
+        if (expr->type == kExprFunctionRef)
+            return true;
+    return false;
 }
 
-void SQLExec::expression(const Expr *expr, vector<Value> *res){
-    if(expr->type == kExprColumnRef || expr->type == kExprLiteralString){
-        res->push_back(Value(expr->name));
-    } else if(expr->type == kExprLiteralInt){
-        res->push_back(Value(expr->ival));
-    } else if(expr->type == kExprOperator){
-        operator_expression(expr, res);
+typedef function<Identifier(const Expr *)> ColumnNamer;  // what the input rows call a referenced column
+
+// Work out the Aggregation an aggregating SELECT asks for, the names of its result columns (in select-list order),
+// and the sort order of its ORDER BY, which can name the group-by columns and the aggregates' aliases.
+static void parse_aggregation(const SelectStatement *statement, const ColumnNamer &input_name,
+                              Aggregation &aggregation, ColumnNames &cols, SortOrder &sort_order) {
+    static const map<string, AggregateFunction::Function> functions = {
+            {"COUNT", AggregateFunction::COUNT}, {"SUM", AggregateFunction::SUM}, {"MIN", AggregateFunction::MIN},
+            {"MAX", AggregateFunction::MAX}, {"AVG", AggregateFunction::AVG}};
+    if (statement->groupBy != nullptr) {
+        if (statement->groupBy->having != nullptr)
+            throw SQLExecError("not support HAVING");
+        for (auto const expr: *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef)
+                throw SQLExecError("GROUP BY only supports columns");
+            aggregation.group_by.push_back(input_name(expr));
+        }
     }
-    else {
-        throw SQLExecError("not support this op");
+    for (auto const expr: *statement->selectList) {
+        if (expr->type == kExprColumnRef) {
+            Identifier column_name = input_name(expr);
+            if (find(aggregation.group_by.begin(), aggregation.group_by.end(), column_name) ==
+                aggregation.group_by.end())
+                throw SQLExecError("column '" + column_name + "' must be in GROUP BY or in an aggregate function");
+            cols.push_back(column_name);
+            continue;
+        }
+        if (expr->type != kExprFunctionRef)
+            throw SQLExecError("not support this select list");
+        string function_name = expr->name;
+        transform(function_name.begin(), function_name.end(), function_name.begin(), ::toupper);
+        auto function = functions.find(function_name);
+        if (function == functions.end())
+            throw SQLExecError("unknown function " + function_name);
+        if (expr->distinct)
+            throw SQLExecError("not support DISTINCT in " + function_name);
+        const Expr *argument = expr->expr;
+        Identifier column_name;
+        string written;
+        if (argument != nullptr && argument->type == kExprStar && function->second == AggregateFunction::COUNT) {
+            written = "*";
+        } else if (argument != nullptr && argument->type == kExprColumnRef) {
+            column_name = input_name(argument);
+            written = argument->table != nullptr ? string(argument->table) + "." + argument->name : argument->name;
+        } else {
+            throw SQLExecError(function_name + " needs a column");
+        }
+        Identifier name = expr->alias != nullptr ? expr->alias : function_name + "(" + written + ")";
+        aggregation.functions.push_back(AggregateFunction(function->second, column_name, name));
+        cols.push_back(name);
+    }
+    if (statement->order != nullptr) {
+        for (auto const order: *statement->order) {
+            const Expr *expr = order_column(order);
+            Identifier column_name;
+            for (auto const &function: aggregation.functions)
+                if (expr->table == nullptr && function.name == expr->name)
+                    column_name = function.name;
+            if (column_name.empty()) {
+                column_name = input_name(expr);
+                if (find(aggregation.group_by.begin(), aggregation.group_by.end(), column_name) ==
+                    aggregation.group_by.end())
+                    throw SQLExecError("ORDER BY column '" + column_name + "' is not in the results");
+            }
+            sort_order.push_back(make_pair(column_name, order->type == kOrderDesc));
+        }
     }
 }
 
+// Aggregate the given input rows (see parse_aggregation) and get the results.
+static QueryResult *select_aggregate(const SelectStatement *statement, EvalPlan *input, const Aggregation &aggregation,
+                                     const SortOrder &sort_order, const ColumnNames &cols, Arena *arena) {
+    EvalPlan *plan = new EvalPlan(new Aggregation(aggregation), input);
+    if (statement->selectDistinct)
+        plan = new EvalPlan(new ColumnNames(cols), plan);
+    plan = order_and_limit(statement, sort_order.empty() ? nullptr : new SortOrder(sort_order), plan);
+    plan = new EvalPlan(new ColumnNames(cols), plan);
+    ColumnNames *names = new ColumnNames;
+    ColumnAttributes *attrs = new ColumnAttributes;
+    EvalPlan *optimized = nullptr;
+    ValueDicts *rows;
+    try {
+        plan->get_columns(*names, *attrs);
+        optimized = plan->optimize();
+        rows = optimized->evaluate(arena);
+    } catch (...) {
+        delete plan;
+        delete optimized;
+        delete names;
+        delete attrs;
+        throw;
+    }
+    delete plan;
+    delete optimized;
+    return new QueryResult(names, attrs, rows, "successfully returned " + to_string(rows->size()) + " rows", arena);
+}
 
-QueryResult *SQLExec::select(const SelectStatement *statement) {
+QueryResult *SQLExec::select(const SelectStatement *statement, Arena *arena) {
+    if (statement->fromTable->type != kTableName)
+        return select_join(statement, arena);
     Identifier table_name = statement->fromTable->name;
     if(!table_exist(table_name)){
         throw SQLExecError(table_name + " not exist");
@@ -254,6 +590,46 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
     DbRelation &table = tables->get_table(table_name);
     const ColumnNames &all_cols = table.get_column_names();
     ColumnAttributes all_col_attrs = table.get_column_attributes();
+    if (aggregating(statement)) {
+        ColumnNamer input_name = [&all_cols](const Expr *expr) {
+            if (find(all_cols.begin(), all_cols.end(), Identifier(expr->name)) == all_cols.end())
+                throw SQLExecError(string("unknown column '") + expr->name + "'");
+            return Identifier(expr->name);
+        };
+        Aggregation aggregation;
+        ColumnNames cols;
+        SortOrder sort_order;
+        parse_aggregation(statement, input_name, aggregation, cols, sort_order);
+        // just the columns the aggregation reads
+        ColumnNames *inputs = new ColumnNames(aggregation.group_by);
+        for (auto const &function: aggregation.functions)
+            if (!function.column_name.empty() &&
+                find(inputs->begin(), inputs->end(), function.column_name) == inputs->end())
+                inputs->push_back(function.column_name);
+        DbIndexes table_indices;
+        for (auto const &index_name: indices->get_index_names(table_name))
+            table_indices.push_back(&indices->get_index(table_name, index_name));
+        EvalPlan *plan = new EvalPlan(table, table_indices);
+        if (statement->whereClause != nullptr)
+            plan = new EvalPlan(fetch_where_clause(statement->whereClause), plan);
+        return select_aggregate(statement, new EvalPlan(inputs, plan), aggregation, sort_order, cols, arena);
+    }
+    if (statement->order != nullptr) {
+        for (auto const order: *statement->order) {
+            Identifier column_name = order_column(order)->name;
+            if (find(all_cols.begin(), all_cols.end(), column_name) == all_cols.end())
+                throw SQLExecError("unknown column '" + column_name + "'");
+            if (!statement->selectDistinct)
+                continue;
+            bool selected = false;
+            for (auto const expr: *statement->selectList)
+                if (expr->type == kExprStar || column_name == expr->name)
+                    selected = true;
+            if (!selected)
+                throw SQLExecError("for SELECT DISTINCT, ORDER BY column '" + column_name +
+                                   "' must be in the select list");
+        }
+    }
     ColumnNames *cols = new ColumnNames;
     ColumnAttributes *attrs = new ColumnAttributes;
     // fetch all specified cols
@@ -276,16 +652,298 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
             }
         }
     }
-    EvalPlan *plan = new EvalPlan(table);
+    DbIndexes table_indices;
+    for (auto const &index_name: indices->get_index_names(table_name))
+        table_indices.push_back(&indices->get_index(table_name, index_name));
+    EvalPlan *plan = new EvalPlan(table, table_indices);
     if(statement->whereClause != NULL){
-        ValueDict *where = fetch_where_clause(statement->whereClause);
+        Conjunction *where;
+        try {
+            where = fetch_where_clause(statement->whereClause);
+        } catch (...) {
+            delete plan;
+            delete cols;
+            delete attrs;
+            throw;
+        }
         plan = new EvalPlan(where, plan);
     }
-    plan = new EvalPlan(cols, plan);
-    plan = plan->optimize();
-    ValueDicts *rows = plan->evaluate();
+    if (statement->order != nullptr) {
+        // sort the selected columns along with any others to sort by, then leave those out
+        SortOrder *sort_order = new SortOrder();
+        ColumnNames *sort_cols = new ColumnNames(*cols);
+        for (auto const order: *statement->order) {
+            Identifier column_name = order->expr->name;
+            sort_order->push_back(make_pair(column_name, order->type == kOrderDesc));
+            if (find(sort_cols->begin(), sort_cols->end(), column_name) == sort_cols->end())
+                sort_cols->push_back(column_name);
+        }
+        if (statement->selectDistinct) {
+            delete sort_cols;
+            plan = order_and_limit(statement, sort_order, new EvalPlan(new ColumnNames(*cols), plan));
+        } else {
+            plan = order_and_limit(statement, sort_order, new EvalPlan(sort_cols, plan));
+            plan = new EvalPlan(new ColumnNames(*cols), plan);
+        }
+    } else {
+        plan = order_and_limit(statement, nullptr, new EvalPlan(new ColumnNames(*cols), plan));
+    }
+    EvalPlan *optimized = plan->optimize();
+    delete plan;
+    ValueDicts *rows;
+    try {
+        rows = optimized->evaluate(arena);
+    } catch (...) {
+        delete optimized;
+        delete cols;
+        delete attrs;
+        throw;
+    }
+    delete optimized;
+    return new QueryResult(cols, attrs, rows, "successfully returned " + to_string(rows->size()) + " rows", arena);
+}
+
+// A table in the FROM clause of a multi-table SELECT.
+struct FromTable {
+    Identifier alias;  // what the query calls it (its name unless given an alias)
+    DbRelation *relation;
+    std::vector<bool> needed;  // by column: whether the query uses it
+    Conjunction where;  // the conditions on just this table
+};
+
+// What a column is called in the joined rows: its own name, unless another table has a column by that name too.
+static Identifier joined_name(const vector<FromTable> &from, uint table_num, uint col_num) {
+    const Identifier &column_name = from[table_num].relation->get_column_names()[col_num];
+    for (uint i = 0; i < from.size(); i++) {
+        const ColumnNames &column_names = from[i].relation->get_column_names();
+        if (i != table_num && find(column_names.begin(), column_names.end(), column_name) != column_names.end())
+            return from[table_num].alias + "." + column_name;
+    }
+    return column_name;
+}
+
+// Find the table and column of a column reference (qualified by a table or alias, or else unambiguous).
+static uint resolve(vector<FromTable> &from, const Expr *expr, uint &col_num) {
+    int found = -1;
+    for (uint i = 0; i < from.size(); i++) {
+        if (expr->table != nullptr && from[i].alias != expr->table)
+            continue;
+        const ColumnNames &column_names = from[i].relation->get_column_names();
+        auto column = find(column_names.begin(), column_names.end(), Identifier(expr->name));
+        if (column == column_names.end())
+            continue;
+        if (found >= 0)
+            throw SQLExecError(string("column '") + expr->name + "' is ambiguous");
+        found = (int) i;
+        col_num = (uint) (column - column_names.begin());
+    }
+    if (found < 0)
+        throw SQLExecError(string("unknown column '") +
+                           (expr->table != nullptr ? string(expr->table) + "." : string()) + expr->name + "'");
+    from[found].needed[col_num] = true;
+    return (uint) found;
+}
+
+void SQLExec::from_tables(const TableRef *table_ref, vector<const TableRef *> &from, vector<const Expr *> &conditions) {
+    switch (table_ref->type) {
+        case kTableName:
+            from.push_back(table_ref);
+            break;
+        case kTableCrossProduct:
+            for (auto const listed: *table_ref->list)
+                from_tables(listed, from, conditions);
+            break;
+        case kTableJoin:
+            if (table_ref->join->type != kJoinInner)
+                throw SQLExecError("only inner joins are supported");
+            from_tables(table_ref->join->left, from, conditions);
+            from_tables(table_ref->join->right, from, conditions);
+            if (table_ref->join->condition != nullptr)
+                conjuncts(table_ref->join->condition, conditions);
+            break;
+        default:
+            throw SQLExecError("not support this FROM clause");
+    }
+}
+
+void SQLExec::conjuncts(const Expr *expr, vector<const Expr *> &conditions) {
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        conjuncts(expr->expr, conditions);
+        conjuncts(expr->expr2, conditions);
+    } else {
+        conditions.push_back(expr);
+    }
+}
+
+// SELECT from several tables (FROM a, b and/or a JOIN b ON ...). The conditions on a single table are pushed down
+// to it, and the tables are joined left to right with hash joins on the equalities between their columns (a
+// table with no equality to the tables before it is joined to them on no columns, i.e., a cross product). In the
+// results, a column is called by its name, or by <table>.<name> if more than one of the tables has that column.
+// With ORDER BY, the joined rows are sorted (or just the top ones kept, with LIMIT) before the result columns are
+// picked out (with DISTINCT, they are picked out first, and then sorted and made distinct).
+// With GROUP BY or aggregate functions, the joined rows are aggregated instead.
+QueryResult *SQLExec::select_join(const SelectStatement *statement, Arena *arena) {
+    vector<const TableRef *> table_refs;
+    vector<const Expr *> conditions;
+    from_tables(statement->fromTable, table_refs, conditions);
+    if (statement->whereClause != nullptr)
+        conjuncts(statement->whereClause, conditions);
+    vector<FromTable> from(table_refs.size());
+    for (uint i = 0; i < table_refs.size(); i++) {
+        Identifier table_name = table_refs[i]->name;
+        if (!table_exist(table_name))
+            throw SQLExecError(table_name + " not exist");
+        from[i].alias = table_refs[i]->alias != nullptr ? table_refs[i]->alias : table_name;
+        for (uint j = 0; j < i; j++)
+            if (from[j].alias == from[i].alias)
+                throw SQLExecError("table '" + from[i].alias + "' appears twice; give it an alias");
+        from[i].relation = &tables->get_table(table_name);
+        from[i].needed.assign(from[i].relation->get_column_names().size(), false);
+    }
+
+    // the result columns
+    vector<pair<uint, uint>> selected;  // (table, column)
+    bool aggregates = aggregating(statement);
+    Aggregation aggregation;
+    ColumnNames aggregate_cols;
+    SortOrder aggregate_order;
+    if (aggregates) {
+        ColumnNamer input_name = [&from](const Expr *expr) {
+            uint col_num;
+            uint table_num = resolve(from, expr, col_num);
+            return joined_name(from, table_num, col_num);
+        };
+        parse_aggregation(statement, input_name, aggregation, aggregate_cols, aggregate_order);
+    } else {
+        for (auto const expr: *statement->selectList) {
+            if (expr->type == kExprStar) {
+                for (uint i = 0; i < from.size(); i++)
+                    if (expr->table == nullptr || from[i].alias == expr->table)
+                        for (uint col_num = 0; col_num < from[i].needed.size(); col_num++) {
+                            from[i].needed[col_num] = true;
+                            selected.push_back(make_pair(i, col_num));
+                        }
+            } else if (expr->type == kExprColumnRef) {
+                uint col_num;
+                uint table_num = resolve(from, expr, col_num);
+                selected.push_back(make_pair(table_num, col_num));
+            } else {
+                throw SQLExecError("not support this select list");
+            }
+        }
+    }
+    vector<pair<uint, uint>> ordered;  // (table, column) for each ORDER BY item
+    if (statement->order != nullptr && !aggregates) {
+        for (auto const order: *statement->order) {
+            uint col_num;
+            uint table_num = resolve(from, order_column(order), col_num);
+            ordered.push_back(make_pair(table_num, col_num));
+            if (statement->selectDistinct && find(selected.begin(), selected.end(), ordered.back()) == selected.end())
+                throw SQLExecError("for SELECT DISTINCT, ORDER BY column '" +
+                                   joined_name(from, table_num, col_num) + "' must be in the select list");
+        }
+    }
+
+    // split the conditions into the equalities between two tables' columns and the conditions on one table
+    struct Equality {
+        uint left_table, left_column, right_table, right_column;
+    };
+    vector<Equality> equalities;
+    for (auto const expr: conditions) {
+        if (expr->type != kExprOperator || expr->expr == nullptr)
+            throw SQLExecError("not support this where clause");
+        if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=' && expr->expr->type == kExprColumnRef &&
+            expr->expr2->type == kExprColumnRef) {
+            Equality equality;
+            equality.left_table = resolve(from, expr->expr, equality.left_column);
+            equality.right_table = resolve(from, expr->expr2, equality.right_column);
+            if (equality.left_table == equality.right_table)
+                throw SQLExecError("not support comparing two columns of one table");
+            equalities.push_back(equality);
+            continue;
+        }
+        const Expr *column = expr->expr->type == kExprColumnRef || expr->expr2 == nullptr ? expr->expr : expr->expr2;
+        if (column->type != kExprColumnRef)
+            throw SQLExecError("a comparison needs a column on one side");
+        uint col_num;
+        conjunction(expr, from[resolve(from, column, col_num)].where);
+    }
+
+    // the plan for each table: its conditions, then its columns the query uses under their joined names
+    vector<EvalPlan *> sides;
+    for (uint i = 0; i < from.size(); i++) {
+        const Identifier table_name = from[i].relation->get_table_name();
+        DbIndexes table_indices;
+        for (auto const &index_name: indices->get_index_names(table_name))
+            table_indices.push_back(&indices->get_index(table_name, index_name));
+        EvalPlan *side = new EvalPlan(*from[i].relation, table_indices);
+        if (!from[i].where.empty())
+            side = new EvalPlan(new Conjunction(from[i].where), side);
+        const ColumnNames &column_names = from[i].relation->get_column_names();
+        bool all = find(from[i].needed.begin(), from[i].needed.end(), true) == from[i].needed.end();  // none used
+        ColumnNames *projection = new ColumnNames();
+        ColumnNames *renames = new ColumnNames();
+        for (uint col_num = 0; col_num < column_names.size(); col_num++) {
+            if (all || from[i].needed[col_num]) {
+                projection->push_back(column_names[col_num]);
+                renames->push_back(joined_name(from, i, col_num));
+            }
+        }
+        sides.push_back(new EvalPlan(projection, renames, side));
+    }
+
+    // join them left to right
+    EvalPlan *plan = sides[0];
+    for (uint i = 1; i < from.size(); i++) {
+        ColumnNames *probe_keys = new ColumnNames();
+        ColumnNames *build_keys = new ColumnNames();
+        for (auto const &equality: equalities) {
+            if (equality.right_table == i && equality.left_table < i) {
+                probe_keys->push_back(joined_name(from, equality.left_table, equality.left_column));
+                build_keys->push_back(joined_name(from, i, equality.right_column));
+            } else if (equality.left_table == i && equality.right_table < i) {
+                probe_keys->push_back(joined_name(from, equality.right_table, equality.right_column));
+                build_keys->push_back(joined_name(from, i, equality.left_column));
+            }
+        }
+        plan = new EvalPlan(plan, sides[i], probe_keys, build_keys);
+    }
+    if (aggregates)
+        return select_aggregate(statement, plan, aggregation, aggregate_order, aggregate_cols, arena);
+
+    ColumnNames *cols = new ColumnNames;
+    ColumnAttributes *attrs = new ColumnAttributes;
+    for (auto const &column: selected) {
+        cols->push_back(joined_name(from, column.first, column.second));
+        attrs->push_back(from[column.first].relation->get_column_attributes()[column.second]);
+    }
+    if (!ordered.empty()) {
+        SortOrder *sort_order = new SortOrder();
+        for (uint i = 0; i < ordered.size(); i++)
+            sort_order->push_back(make_pair(joined_name(from, ordered[i].first, ordered[i].second),
+                                            (*statement->order)[i]->type == kOrderDesc));
+        if (statement->selectDistinct) {
+            plan = order_and_limit(statement, sort_order, new EvalPlan(new ColumnNames(*cols), plan));
+        } else {
+            plan = order_and_limit(statement, sort_order, plan);
+            plan = new EvalPlan(new ColumnNames(*cols), plan);
+        }
+    } else {
+        plan = order_and_limit(statement, nullptr, new EvalPlan(new ColumnNames(*cols), plan));
+    }
+    EvalPlan *optimized = plan->optimize();
     delete plan;
-    return new QueryResult(cols, attrs, rows, "successfully returned " + to_string(rows->size()) + " rows");
+    ValueDicts *rows;
+    try {
+        rows = optimized->evaluate(arena);
+    } catch (...) {
+        delete optimized;
+        delete cols;
+        delete attrs;
+        throw;
+    }
+    delete optimized;
+    return new QueryResult(cols, attrs, rows, "successfully returned " + to_string(rows->size()) + " rows", arena);
 }
 
 void
@@ -305,10 +963,281 @@ SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_name,
 }
 
 // CREATE ...
-QueryResult *SQLExec::create(const CreateStatement *statement) {
+bool SQLExec::extract_table_options(string &query, TableOptions &options) {
+    static const regex create_table("^\\s*CREATE\\s+TABLE\\s", regex::icase);
+    static const regex with_clause("\\s+WITH\\s*\\(([^()]*)\\)\\s*;?\\s*$", regex::icase);
+    static const regex option("^\\s*(\\w+)\\s*=\\s*(\\w+)\\s*$");
+    smatch clause;
+    if (!regex_search(query, create_table) || !regex_search(query, clause, with_clause))
+        return false;
+    string list = clause[1].str();
+    size_t start = 0;
+    while (true) {
+        size_t comma = list.find(',', start);
+        string item = list.substr(start, comma == string::npos ? string::npos : comma - start);
+        smatch name_value;
+        if (!regex_match(item, name_value, option))
+            throw SQLExecError("invalid table option '" + item + "'");
+        string name = name_value[1].str(), value = name_value[2].str();
+        transform(name.begin(), name.end(), name.begin(), ::toupper);
+        transform(value.begin(), value.end(), value.begin(), ::toupper);
+        options[name] = value;
+        if (comma == string::npos)
+            break;
+        start = comma + 1;
+    }
+    query.erase(clause.position(0));
+    return true;
+}
+
+// The statement cache: a hit moves to the front, a miss is parsed and added there (and the back is let go).
+const SQLStatement *SQLExec::parse_cached(const string &query) {
+    vector<Value> literals;
+    string key = strip_literals(query, literals);
+    if (key.empty())
+        return nullptr;
+    PreparedStatement *statement;
+    auto found = statement_cache_index.find(key);
+    if (found != statement_cache_index.end()) {
+        statement_cache.splice(statement_cache.begin(), statement_cache, found->second);
+        statement = found->second->second;
+    } else {
+        SQLParserResult *parse = SQLParser::parseSQLString(key);
+        try {
+            statement = new PreparedStatement(parse);
+            if (statement->parameter_count() != literals.size()) {
+                delete statement;
+                statement = nullptr;
+            }
+        } catch (SQLExecError &e) {
+            delete parse;
+            statement = nullptr;
+        }
+        statement_cache.push_front(make_pair(key, statement));
+        statement_cache_index[key] = statement_cache.begin();
+        if (statement_cache.size() > STATEMENT_CACHE_SIZE) {
+            statement_cache_index.erase(statement_cache.back().first);
+            delete statement_cache.back().second;
+            statement_cache.pop_back();
+        }
+    }
+    if (statement == nullptr)
+        return nullptr;
+    statement->bind(literals);
+    return statement->get_statement();
+}
+
+// Literals are single-quoted strings and integers, except the counts of a LIMIT or OFFSET (which the parser
+// won't take as placeholders). A minus sign right after a parenthesis, comma or comparison is part of its integer.
+// Lines with placeholders of their own, several statements, or other kinds of numbers are left to the parser.
+// (A trailing semicolon is dropped.)
+string SQLExec::strip_literals(const string &query, vector<Value> &literals) {
+    static const regex cacheable("^\\s*(SELECT|INSERT|UPDATE|DELETE)\\s", regex::icase);
+    if (!regex_search(query, cacheable))
+        return "";
+    string key;
+    bool count_next = false;  // after LIMIT or OFFSET
+    char last = ' ';          // the last character of the key other than white space
+    size_t i = 0;
+    while (i < query.size()) {
+        char c = query[i];
+        size_t end = i + 1;
+        if (isspace(c)) {
+            if (!key.empty() && key.back() != ' ')
+                key += ' ';
+            i = end;
+            continue;
+        }
+        bool count = false;
+        if (isalpha(c) || c == '_') {
+            while (end < query.size() && (isalnum(query[end]) || query[end] == '_' || query[end] == '$'))
+                end++;
+            string word = query.substr(i, end - i);
+            key += word;
+            transform(word.begin(), word.end(), word.begin(), ::toupper);
+            count = word == "LIMIT" || word == "OFFSET";
+        } else if (c == '"' || c == '\'') {
+            end = query.find(c, i + 1);
+            if (end == string::npos)
+                return "";
+            end++;
+            if (c == '"') {
+                key += query.substr(i, end - i);  // a quoted name
+            } else {
+                literals.push_back(Value(query.substr(i + 1, end - i - 2)));
+                key += '?';
+            }
+        } else if (isdigit(c) || (c == '-' && end < query.size() && isdigit(query[end]) && strchr("(,=<>", last))) {
+            while (end < query.size() && isdigit(query[end]))
+                end++;
+            if (end - i > 10 || (end < query.size() && (query[end] == '.' || isalpha(query[end]) || query[end] == '_')))
+                return "";
+            if (count_next) {
+                key += query.substr(i, end - i);
+            } else {
+                literals.push_back(Value((int32_t) stoll(query.substr(i, end - i))));
+                key += '?';
+            }
+        } else if (c == ';' && query.find_first_not_of(" \t\r\n", end) == string::npos) {
+            break;
+        } else if (c == '?' || c == ';') {
+            return "";
+        } else {
+            key += c;
+        }
+        count_next = count;
+        last = key.back();
+        i = end;
+    }
+    if (!key.empty() && key.back() == ' ')
+        key.pop_back();
+    return key;
+}
+
+// PREPARE name FROM statement
+QueryResult *SQLExec::prepare(const PrepareStatement *statement) {
+    // the prepared statement keeps the parse of the query (so the parse tree of the PREPARE must let go of it)
+    PrepareStatement *taking = const_cast<PrepareStatement *>(statement);
+    PreparedStatement *prepared_statement = new PreparedStatement(taking->query);
+    taking->query = nullptr;
+    Identifier name = statement->name;
+    if (prepared.find(name) != prepared.end())
+        delete prepared[name];
+    prepared[name] = prepared_statement;
+    return new QueryResult("prepared " + name + " with " + to_string(prepared_statement->parameter_count()) +
+                           " parameters");
+}
+
+// EXECUTE name(parameters)
+QueryResult *SQLExec::execute_prepared(const ExecuteStatement *statement) {
+    Identifier name = statement->name;
+    if (prepared.find(name) == prepared.end())
+        throw SQLExecError("no prepared statement " + name);
+    vector<Value> parameters;
+    if (statement->parameters != nullptr)
+        for (auto const &parameter: *statement->parameters)
+            parameters.push_back(literal(parameter));
+    PreparedStatement *prepared_statement = prepared[name];
+    prepared_statement->bind(parameters);
+    return execute(prepared_statement->get_statement());
+}
+
+// DEALLOCATE PREPARE name
+QueryResult *SQLExec::deallocate(const DropStatement *statement) {
+    Identifier name = statement->name;
+    if (prepared.find(name) == prepared.end())
+        throw SQLExecError("no prepared statement " + name);
+    delete prepared[name];
+    prepared.erase(name);
+    return new QueryResult("deallocated " + name);
+}
+
+PreparedStatement::PreparedStatement(SQLParserResult *parse) : parse(parse), statement(nullptr), placeholders() {
+    if (parse == nullptr || !parse->isValid() || parse->size() != 1)
+        throw SQLExecError("can only prepare one statement");
+    statement = parse->getMutableStatement(0);
+    switch (statement->type()) {
+        case kStmtSelect:
+            find_placeholders((SelectStatement *) statement);
+            break;
+        case kStmtInsert: {
+            auto *insert = (InsertStatement *) statement;
+            if (insert->values != nullptr)
+                for (auto const &value: *insert->values)
+                    find_placeholders(value);
+            if (insert->select != nullptr)
+                find_placeholders(insert->select);
+            break;
+        }
+        case kStmtUpdate: {
+            auto *update = (UpdateStatement *) statement;
+            for (auto const &clause: *update->updates)
+                find_placeholders(clause->value);
+            find_placeholders(update->where);
+            break;
+        }
+        case kStmtDelete:
+            find_placeholders(((DeleteStatement *) statement)->expr);
+            break;
+        default:
+            throw SQLExecError("can only prepare SELECT, INSERT, UPDATE or DELETE");
+    }
+    // the parser numbers the placeholders in the order they appear
+    stable_sort(placeholders.begin(), placeholders.end(),
+                [](const Expr *a, const Expr *b) { return a->ival < b->ival; });
+}
+
+PreparedStatement::~PreparedStatement() {
+    delete parse;
+}
+
+void PreparedStatement::bind(const vector<Value> &parameters) {
+    if (parameters.size() != placeholders.size())
+        throw SQLExecError("expected " + to_string(placeholders.size()) + " parameters, got " +
+                           to_string(parameters.size()));
+    for (uint i = 0; i < parameters.size(); i++) {
+        Expr *placeholder = placeholders[i];
+        free(placeholder->name);
+        placeholder->name = nullptr;
+        if (parameters[i].data_type == ColumnAttribute::TEXT) {
+            placeholder->type = kExprLiteralString;
+            placeholder->name = strdup(parameters[i].s().c_str());
+        } else {
+            placeholder->type = kExprLiteralInt;
+            placeholder->ival = parameters[i].n;
+        }
+    }
+}
+
+void PreparedStatement::find_placeholders(SelectStatement *select) {
+    for (auto const &expr: *select->selectList)
+        find_placeholders(expr);
+    find_placeholders(select->fromTable);
+    find_placeholders(select->whereClause);
+    if (select->groupBy != nullptr) {
+        if (select->groupBy->columns != nullptr)
+            for (auto const &expr: *select->groupBy->columns)
+                find_placeholders(expr);
+        find_placeholders(select->groupBy->having);
+    }
+    if (select->order != nullptr)
+        for (auto const &order: *select->order)
+            find_placeholders(order->expr);
+}
+
+void PreparedStatement::find_placeholders(TableRef *table_ref) {
+    if (table_ref == nullptr)
+        return;
+    if (table_ref->select != nullptr)
+        find_placeholders(table_ref->select);
+    if (table_ref->list != nullptr)
+        for (auto const &item: *table_ref->list)
+            find_placeholders(item);
+    if (table_ref->join != nullptr) {
+        find_placeholders(table_ref->join->left);
+        find_placeholders(table_ref->join->right);
+        find_placeholders(table_ref->join->condition);
+    }
+}
+
+void PreparedStatement::find_placeholders(Expr *expr) {
+    if (expr == nullptr)
+        return;
+    if (expr->type == kExprPlaceholder)
+        placeholders.push_back(expr);
+    find_placeholders(expr->expr);
+    find_placeholders(expr->expr2);
+    if (expr->exprList != nullptr)
+        for (auto const &item: *expr->exprList)
+            find_placeholders(item);
+    if (expr->select != nullptr)
+        find_placeholders(expr->select);
+}
+
+QueryResult *SQLExec::create(const CreateStatement *statement, const TableOptions *options) {
     switch (statement->type) {
         case CreateStatement::kTable:
-            return create_table(statement);
+            return create_table(statement, options);
         case CreateStatement::kIndex:
             return create_index(statement);
         default:
@@ -316,8 +1245,18 @@ QueryResult *SQLExec::create(const CreateStatement *statement) {
     }
 }
 
-QueryResult *SQLExec::create_table(const CreateStatement *statement) {
+QueryResult *SQLExec::create_table(const CreateStatement *statement, const TableOptions *options) {
     Identifier table_name = statement->tableName;
+    string storage_type = "HEAP";
+    if (options != nullptr) {
+        for (auto const &option: *options)
+            if (option.first != "STORAGE")
+                throw SQLExecError("unknown table option " + option.first);
+        if (options->find("STORAGE") != options->end())
+            storage_type = options->at("STORAGE");
+        if (storage_type != "HEAP" && storage_type != "BTREE")
+            throw SQLExecError("unknown storage type " + storage_type);
+    }
     ColumnNames column_names;
     ColumnAttributes column_attributes;
     Identifier column_name;
@@ -331,7 +1270,9 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
     // Add to schema: _tables and _columns
     ValueDict row;
     row["table_name"] = table_name;
+    row["storage_type"] = Value(storage_type);
     Handle t_handle = SQLExec::tables->insert(&row);  // Insert into _tables
+    row.erase("storage_type");
     try {
         Handles c_handles;
         DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
@@ -374,6 +1315,8 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
 
     // get underlying relation
     DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (dynamic_cast<BTreeRelation *>(&table) != nullptr)
+        throw SQLExecError(table_name + " has btree storage, so it is already organized by its primary key");
 
     // check that given columns exist in table
     const ColumnNames &table_columns = table.get_column_names();
@@ -386,7 +1329,7 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
     row["table_name"] = Value(table_name);
     row["index_name"] = Value(index_name);
     row["index_type"] = Value(statement->indexType);
-    row["is_unique"] = Value(string(statement->indexType) == "BTREE"); // assume HASH is non-unique --
+    row["is_unique"] = Value(false); // the parser has no UNIQUE, so allow duplicate keys in any index type --
     int seq = 0;
     Handles i_handles;
     try {
@@ -417,6 +1360,8 @@ QueryResult *SQLExec::drop(const DropStatement *statement) {
             return drop_table(statement);
         case DropStatement::kIndex:
             return drop_index(statement);
+        case DropStatement::kPreparedStatement:
+            return deallocate(statement);
         default:
             return new QueryResult("Only DROP TABLE and CREATE INDEX are implemented");
     }
@@ -544,7 +1489,7 @@ QueryResult *SQLExec::show_tables() {
     ValueDicts *rows = new ValueDicts;
     for (auto const &handle: *handles) {
         ValueDict *row = SQLExec::tables->project(handle, column_names);
-        Identifier table_name = row->at("table_name").s;
+        Identifier table_name = row->at("table_name").s();
         if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME && table_name != Indices::TABLE_NAME)
             rows->push_back(row);
         else
@@ -595,4 +1540,125 @@ bool SQLExec::table_exist(Identifier table_name){
     }
     delete query_result;
     return res;
-}
\ No newline at end of file
+}
+
+// Parse and run one statement (the result is freed by the caller).
+static QueryResult *test_run(const string &query) {
+    SQLParserResult *parse = SQLParser::parseSQLString(query);
+    if (!parse->isValid() || parse->size() != 1) {
+        delete parse;
+        throw SQLExecError("invalid SQL: " + query);
+    }
+    QueryResult *result;
+    try {
+        result = SQLExec::execute(parse->getStatement(0));
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    delete parse;
+    return result;
+}
+
+// Check that running one statement fails.
+static bool test_fails(const string &query) {
+    try {
+        delete test_run(query);
+    } catch (SQLExecError &e) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Testing function for the statement cache and prepared statements.
+ * @return true if the tests all succeeded
+ */
+bool test_sql_exec() {
+    // keys: the literals taken out, white space and a trailing semicolon tidied, names and LIMIT counts left in
+    vector<Value> literals;
+    string key = SQLExec::strip_literals("select  *\tfrom t where id = 5 and name = 'a?b' ;", literals);
+    if (key != "select * from t where id = ? and name = ?" || literals.size() != 2 || literals[0] != Value(5) ||
+        literals[1] != Value("a?b")) {
+        cout << "strip literals failed: " << key << endl;
+        return false;
+    }
+    literals.clear();
+    key = SQLExec::strip_literals("SELECT a FROM t WHERE a IN (-3, 4) AND \"b;?\" = 'x' LIMIT 10 OFFSET 2", literals);
+    if (key != "SELECT a FROM t WHERE a IN (?, ?) AND \"b;?\" = ? LIMIT 10 OFFSET 2" || literals.size() != 3 ||
+        literals[0] != Value(-3) || literals[1] != Value(4) || literals[2] != Value("x")) {
+        cout << "strip literals with quoted names failed: " << key << endl;
+        return false;
+    }
+    for (auto const &query: {"select * from t where a = ?", "select * from t where a = 1.5",
+                             "select * from t; select * from u", "select * from t where b = 'open",
+                             "create table t (a int)"}) {
+        literals.clear();
+        if (!SQLExec::strip_literals(query, literals).empty()) {
+            cout << "strip literals took: " << query << endl;
+            return false;
+        }
+    }
+    cout << "strip literals ok" << endl;
+
+    // lines that differ only in their literals share a parse, bound afresh each time
+    for (auto const &entry: SQLExec::statement_cache)
+        delete entry.second;
+    SQLExec::statement_cache.clear();
+    SQLExec::statement_cache_index.clear();
+    const SQLStatement *first = SQLExec::parse_cached("select a from __test_cache where a = 1 and b = 'x'");
+    string first_text = first == nullptr ? "" : ParseTreeToString::statement(first);
+    const SQLStatement *second = SQLExec::parse_cached("select a from __test_cache where a = 2 and b = 'y'");
+    if (first == nullptr || second != first || first_text != "SELECT a FROM __test_cache WHERE a = 1 AND b = \"x\"" ||
+        ParseTreeToString::statement(second) != "SELECT a FROM __test_cache WHERE a = 2 AND b = \"y\"" ||
+        SQLExec::statement_cache.size() != 1) {
+        cout << "statement cache hit failed: " << first_text << endl;
+        return false;
+    }
+
+    // the least recently used entry goes once there are too many
+    string first_key = SQLExec::statement_cache.front().first;
+    for (uint i = 0; i < SQLExec::STATEMENT_CACHE_SIZE; i++) {
+        if (i == SQLExec::STATEMENT_CACHE_SIZE - 1)
+            SQLExec::parse_cached("select a from __test_cache where a = 3 and b = 'z'");  // first is used again
+        SQLExec::parse_cached("select a from __test_cache_" + to_string(i) + " where a = 1");
+    }
+    if (SQLExec::statement_cache.size() != SQLExec::STATEMENT_CACHE_SIZE ||
+        SQLExec::statement_cache_index.count(first_key) != 1 ||
+        SQLExec::statement_cache_index.count("select a from __test_cache_0 where a = ?") != 0 ||
+        SQLExec::statement_cache_index.count("select a from __test_cache_1 where a = ?") != 1) {
+        cout << "statement cache eviction failed" << endl;
+        return false;
+    }
+    cout << "statement cache ok" << endl;
+
+    // PREPARE, EXECUTE and DEALLOCATE
+    delete test_run("create table __test_prepared (id int, name text)");
+    delete test_run("prepare __test_insert from insert into __test_prepared values (?, ?)");
+    for (int i = 1; i <= 3; i++)
+        delete test_run("execute __test_insert(" + to_string(i) + ", 'name " + to_string(i) + "')");
+    if (!test_fails("execute __test_insert('x', 'y')") || !test_fails("execute __test_insert(4)")) {
+        cout << "prepared insert with bad parameters failed" << endl;
+        return false;
+    }
+    delete test_run("prepare __test_select from select name from __test_prepared where id = ?");
+    for (int i = 3; i >= 1; i--) {
+        QueryResult *result = test_run("execute __test_select(" + to_string(i) + ")");
+        bool bound = result->get_rows()->size() == 1 &&
+                     result->get_rows()->front()->at("name") == Value("name " + to_string(i));
+        delete result;
+        if (!bound) {
+            cout << "prepared select failed for " << i << endl;
+            return false;
+        }
+    }
+    delete test_run("deallocate prepare __test_select");
+    if (!test_fails("execute __test_select(1)")) {
+        cout << "deallocate failed" << endl;
+        return false;
+    }
+    delete test_run("deallocate prepare __test_insert");
+    delete test_run("drop table __test_prepared");
+    cout << "prepared statements ok" << endl;
+    return true;
+}
@@ -6,6 +6,8 @@
 #pragma once
 
 #include <exception>
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 #include "SQLParser.h"
@@ -26,13 +28,19 @@ public:
  */
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message(""), arena(nullptr) {}
 
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+                                       message(message), arena(nullptr) {}
 
     QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message),
+              arena(nullptr) {}
+
+    // rows were made in arena; the result takes over the arena and frees everything in it at once
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message,
+                Arena *arena) : column_names(column_names), column_attributes(column_attributes), rows(rows),
+                                message(message), arena(arena) {}
 
     virtual ~QueryResult();
 
@@ -44,6 +52,8 @@ public:
 
     const std::string &get_message() const { return message; }
 
+    Arena *get_arena() const { return arena; }
+
     friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
 
 protected:
@@ -51,6 +61,55 @@ protected:
     ColumnAttributes *column_attributes;
     ValueDicts *rows;
     std::string message;
+    Arena *arena;
+};
+
+
+/**
+ * Options from the WITH ( name = value, ... ) clause of a CREATE TABLE, which the SQL parser doesn't know
+ * about, so the shell cuts it off first (see SQLExec::extract_table_options). Names and values are upper case.
+ */
+typedef std::map<std::string, std::string> TableOptions;
+
+
+/**
+ * @class PreparedStatement - a parsed statement with placeholders (?) for some of its literals, which can be run
+ * again and again with other values without being parsed again
+ *
+ * Binding writes the values into the placeholders' nodes of the parse tree, so that the statement then reads (and
+ * executes) as if the values had been typed in.
+ */
+class PreparedStatement {
+public:
+    /**
+     * @param parse  the parse of one SELECT, INSERT, UPDATE or DELETE (taken over by the PreparedStatement)
+     * @throws       SQLExecError for anything else
+     */
+    explicit PreparedStatement(hsql::SQLParserResult *parse);
+
+    virtual ~PreparedStatement();
+
+    const hsql::SQLStatement *get_statement() const { return statement; }
+
+    size_t parameter_count() const { return placeholders.size(); }
+
+    /**
+     * Fill in the placeholders.
+     * @param parameters  values for the placeholders, left to right
+     * @throws            SQLExecError if there are too many or too few
+     */
+    void bind(const std::vector<Value> &parameters);
+
+protected:
+    hsql::SQLParserResult *parse;
+    hsql::SQLStatement *statement;
+    std::vector<hsql::Expr *> placeholders;  // left to right
+
+    void find_placeholders(hsql::SelectStatement *select);
+
+    void find_placeholders(hsql::TableRef *table_ref);
+
+    void find_placeholders(hsql::Expr *expr);
 };
 
 
@@ -62,19 +121,58 @@ public:
     /**
      * Execute the given SQL statement.
      * @param statement   the Hyrise AST of the SQL statement to execute
+     * @param options     table options for a CREATE TABLE (nullptr for none)
      * @returns           the query result (freed by caller)
      */
-    static QueryResult *execute(const hsql::SQLStatement *statement);
+    static QueryResult *execute(const hsql::SQLStatement *statement, const TableOptions *options = nullptr);
+
+    /**
+     * Cut the trailing WITH ( name = value, ... ) clause off a CREATE TABLE so the rest can be parsed.
+     * Supported: storage = heap | btree.
+     * @param query    the SQL text; returned by reference without the clause
+     * @param options  returned by reference: the options given
+     * @returns        true if there was a clause
+     * @throws         SQLExecError if the clause is malformed
+     */
+    static bool extract_table_options(std::string &query, TableOptions &options);
+
+    /**
+     * Parse a line of SQL by way of the statement cache. The line's literals are taken out (leaving placeholders)
+     * and the rest is looked up, so lines that differ only in their literals are parsed just once.
+     * @param query  the SQL text
+     * @returns      the statement with the line's literals bound (owned by the cache, good until the next call),
+     *               or nullptr if the line isn't one SELECT, INSERT, UPDATE or DELETE the cache can take
+     */
+    static const hsql::SQLStatement *parse_cached(const std::string &query);
 
 protected:
     // the one place in the system that holds the _tables table and _indices table
     static Tables *tables;
     static Indices *indices;
 
+    // PREPAREd statements by name
+    static std::map<Identifier, PreparedStatement *> prepared;
+
+    // the statement cache, keyed by SQL text with placeholders for its literals: the entries most recently used
+    // first (nullptr for text that didn't parse as something the cache can take), and where each key is in it
+    typedef std::list<std::pair<std::string, PreparedStatement *> > StatementCache;
+    static StatementCache statement_cache;
+    static std::map<std::string, StatementCache::iterator> statement_cache_index;
+    static const size_t STATEMENT_CACHE_SIZE = 64;
+
+    /**
+     * Take the literals out of a line of SQL.
+     * @param query     the SQL text
+     * @param literals  returned by reference: the literals' values, left to right
+     * @returns         the text with a ? for each literal and runs of white space made one space, or empty if
+     *                  it isn't a SELECT, INSERT, UPDATE or DELETE, or has something the cache leaves alone
+     */
+    static std::string strip_literals(const std::string &query, std::vector<Value> &literals);
+
     // recursive decent into the AST
-    static QueryResult *create(const hsql::CreateStatement *statement);
+    static QueryResult *create(const hsql::CreateStatement *statement, const TableOptions *options);
 
-    static QueryResult *create_table(const hsql::CreateStatement *statement);
+    static QueryResult *create_table(const hsql::CreateStatement *statement, const TableOptions *options);
 
     static QueryResult *create_index(const hsql::CreateStatement *statement);
 
@@ -96,14 +194,63 @@ protected:
 
     static QueryResult *del(const hsql::DeleteStatement *statement);
 
-    static QueryResult *select(const hsql::SelectStatement *statement);
+    static QueryResult *truncate(const Identifier &table_name);
+
+    static QueryResult *update(const hsql::UpdateStatement *statement);
+
+    static QueryResult *prepare(const hsql::PrepareStatement *statement);
+
+    static QueryResult *execute_prepared(const hsql::ExecuteStatement *statement);
+
+    static QueryResult *deallocate(const hsql::DropStatement *statement);
+
+    /**
+     * Find the rows a DELETE or UPDATE is to change.
+     * @param table_name  the table
+     * @param where       the AST of the where clause (nullptr for every row)
+     * @returns           handles of the rows (freed by caller)
+     */
+    static Handles *victims(const Identifier &table_name, const hsql::Expr *where);
+
+    static QueryResult *select(const hsql::SelectStatement *statement, Arena *arena);
+
+    static QueryResult *select_join(const hsql::SelectStatement *statement, Arena *arena);
+
+    /**
+     * Collect the tables of a FROM clause.
+     * @param table_ref   the AST of the FROM clause (table names, cross products and inner joins)
+     * @param from        returned by reference: the table names, left to right
+     * @param conditions  returned by reference: the ANDed parts of the joins' ON conditions
+     * @throws            SQLExecError for anything else
+     */
+    static void from_tables(const hsql::TableRef *table_ref, std::vector<const hsql::TableRef *> &from,
+                            std::vector<const hsql::Expr *> &conditions);
+
+    static void conjuncts(const hsql::Expr *expr, std::vector<const hsql::Expr *> &conditions);
 
     static bool table_exist(Identifier table_name);
 
-    static ValueDict *fetch_where_clause(const hsql::Expr *expr);
+    /**
+     * Turn a where clause into the conditions that must all hold.
+     * @param expr  the AST of the where clause (comparisons of columns with literals, joined by AND)
+     * @returns     the conditions (freed by caller)
+     * @throws      SQLExecError for anything else
+     */
+    static Conjunction *fetch_where_clause(const hsql::Expr *expr);
+
+    static void conjunction(const hsql::Expr *expr, Conjunction &where);
 
-    static void operator_expression(const hsql::Expr *expr, std::vector<Value> *res);
-    static void expression(const hsql::Expr *expr, std::vector<Value> *res);
+    static Value literal(const hsql::Expr *expr);
+
+    /**
+     * The value of a literal to be stored in a column.
+     * @param table        the table
+     * @param column_name  the column
+     * @param expr         the AST of the literal
+     * @returns            its value
+     * @throws             SQLExecError if there is no such column or the literal is of the wrong type for it
+     */
+    static Value column_value(const DbRelation &table, const Identifier &column_name, const hsql::Expr *expr);
 
     /**
      * Pull out column name and attributes from AST's column definition clause
@@ -113,4 +260,8 @@ protected:
      */
     static void
     column_definition(const hsql::ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute);
+
+    friend bool test_sql_exec();
 };
+
+bool test_sql_exec();
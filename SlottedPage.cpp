@@ -31,18 +31,66 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
  * @return the new block's id
  */
 RecordID SlottedPage::add(const Dbt *data) {
-    if (!has_room((u16) data->get_size()))
+    RecordID id = reserve((u16) data->get_size());
+    memcpy(locate(id), data->get_data(), data->get_size());
+    return id;
+}
+
+/**
+ * Add a new record of the given size to the block without filling it in.
+ * The caller writes the record's bytes in place through locate().
+ * @param size  number of bytes in the new record
+ * @return      the new record's id
+ * @throws DbBlockNoRoomError if insufficient room in the block
+ */
+RecordID SlottedPage::reserve(u16 size) {
+    if (!has_room(size))
         throw DbBlockNoRoomError("not enough room for new record");
     u16 id = ++this->num_records;
-    u16 size = (u16) data->get_size();
     this->end_free -= size;
     u16 loc = this->end_free + 1U;
     put_header();
     put_header(id, size, loc);
-    memcpy(this->address(loc), data->get_data(), size);
     return id;
 }
 
+/**
+ * Add a new record of the given size to the block without filling it in, in the slot of a deleted record if
+ * there is one (so a block whose records come and go doesn't fill up with their headers), else as reserve().
+ * Only for a block where nothing refers to a deleted record's id any more.
+ * @param size  number of bytes in the new record
+ * @return      the new record's id
+ * @throws DbBlockNoRoomError if insufficient room in the block
+ */
+RecordID SlottedPage::reuse(u16 size) {
+    u16 old_size, loc;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        get_header(old_size, loc, record_id);
+        if (loc == 0) {
+            if (size > this->unused_bytes())
+                throw DbBlockNoRoomError("not enough room for new record");
+            this->end_free -= size;
+            put_header();
+            put_header(record_id, size, this->end_free + 1U);
+            return record_id;
+        }
+    }
+    return reserve(size);
+}
+
+/**
+ * Where a record's bytes are within the block.
+ * @param record_id
+ * @return pointer to the record in the block's memory, or nullptr if it has been deleted
+ */
+char *SlottedPage::locate(RecordID record_id) const {
+    u16 size, loc;
+    get_header(size, loc, record_id);
+    if (loc == 0)
+        return nullptr;
+    return (char *) this->address(loc);
+}
+
 /**
  * Get a record from the block.
  * @param record_id
@@ -53,7 +101,7 @@ Dbt *SlottedPage::get(RecordID record_id) const {
     get_header(size, loc, record_id);
     if (loc == 0)
         return nullptr;  // this is just a tombstone, record has been deleted
-    return new Dbt(this->address(loc), size);
+    return new Dbt(this->address(loc), size & SIZE_BITS);
 }
 
 /**
@@ -65,6 +113,7 @@ Dbt *SlottedPage::get(RecordID record_id) const {
 void SlottedPage::put(RecordID record_id, const Dbt &data) {
     u16 size, loc;
     get_header(size, loc, record_id);
+    size &= SIZE_BITS;
     u16 new_size = (u16) data.get_size();
     if (new_size > size) {
         u16 extra = new_size - size;
@@ -92,7 +141,25 @@ void SlottedPage::del(RecordID record_id) {
     u16 size, loc;
     get_header(size, loc, record_id);
     put_header(record_id, 0, 0);  // 0 is the tombstone sentinel
-    slide(loc, loc + size);
+    slide(loc, loc + (size & SIZE_BITS));
+}
+
+/**
+ * Get the flags of a record (FORWARD and/or MOVED).
+ * @param record_id  the record
+ * @return           its flags (0 for none)
+ */
+u16 SlottedPage::get_flags(RecordID record_id) const {
+    return (u16) (get_n((u16) 4 * record_id) & ~SIZE_BITS);
+}
+
+/**
+ * Set the flags of a record (FORWARD and/or MOVED), replacing any it had.
+ * @param record_id  the record
+ * @param flags      its new flags
+ */
+void SlottedPage::set_flags(RecordID record_id, u16 flags) {
+    put_n((u16) 4 * record_id, (u16) ((get_n((u16) 4 * record_id) & SIZE_BITS) | flags));
 }
 
 /**
@@ -184,6 +251,17 @@ u16 SlottedPage::unused_bytes() const {
     return unused;
 }
 
+/**
+ * Calculate if an empty block could hold the given records (so a caller can lay out a whole block
+ * without trying it first).
+ * @param count  number of records
+ * @param bytes  total size of the records (not including their headers)
+ * @return       true if they would all fit
+ */
+bool SlottedPage::would_fit(uint count, uint bytes) {
+    return bytes + 4 * (count + 1) <= DbBlock::BLOCK_SZ - 1;
+}
+
 /**
  * Slide the contents to compensate for a smaller/larger record.
  *
@@ -337,6 +415,22 @@ bool test_slotted_page() {
     if (expected != actual)
         return assertion_failure("get 1 back after contracting put of 1 " + actual);
 
+    // test flags: kept when other records slide, cleared by put
+    slot.set_flags(2, SlottedPage::MOVED);
+    rec1_dbt = Dbt(rec1_rev, sizeof(rec1_rev));
+    slot.put(1, rec1_dbt);
+    get_dbt = slot.get(2);
+    expected = string(rec2, sizeof(rec2));
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (expected != actual || slot.get_flags(2) != SlottedPage::MOVED || slot.get_flags(1) != 0)
+        return assertion_failure("flags of 2 after expanding put of 1");
+    slot.put(2, rec2_dbt);
+    if (slot.get_flags(2) != 0)
+        return assertion_failure("flags of 2 after put of 2");
+    rec1_dbt = Dbt(rec1, sizeof(rec1));
+    slot.put(1, rec1_dbt);
+
     // test del (and ids)
     RecordIDs *id_list = slot.ids();
     if (id_list->size() != 2 || id_list->at(0) != 1 || id_list->at(1) != 2)
@@ -351,6 +445,26 @@ bool test_slotted_page() {
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
 
+    // test reuse of the deleted record's slot (then delete it again)
+    RecordID reused = slot.reuse(sizeof(rec1));
+    memcpy(slot.locate(reused), rec1, sizeof(rec1));
+    get_dbt = slot.get(1);
+    expected = string(rec1, sizeof(rec1));
+    actual = get_dbt == nullptr ? "" : string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (reused != 1 || expected != actual)
+        return assertion_failure("reuse of deleted record's slot " + actual);
+    get_dbt = slot.get(2);
+    expected = string(rec2, sizeof(rec2));
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (expected != actual)
+        return assertion_failure("get 2 back after reuse of 1 " + actual);
+    if (slot.reuse(sizeof(rec1)) != 3)
+        return assertion_failure("reuse with no deleted record");
+    slot.del(3);
+    slot.del(1);
+
     // try adding something too big
     rec2_dbt = Dbt(nullptr, DbBlock::BLOCK_SZ - 10); // too big, but only because we have a record in there
     try {
@@ -24,10 +24,17 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+        The top two bits of a record's size are flags (see FORWARD and MOVED), which a table uses to move a
+        row out of a full block without changing its record id.
  *
  */
 class SlottedPage : public DbBlock {
 public:
+    // flags in the top bits of a record's size
+    static const u_int16_t FORWARD = 0x8000;  // the record is just the handle of where its row has moved to
+    static const u_int16_t MOVED = 0x4000;  // the record is a row that moved here (it's found through its forward)
+    static const u_int16_t SIZE_BITS = 0x3fff;
+
     SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
 
     // Big 5 - use the defaults
@@ -35,12 +42,22 @@ public:
 
     virtual RecordID add(const Dbt *data);
 
+    virtual RecordID reserve(u_int16_t size);
+
+    virtual RecordID reuse(u_int16_t size);  // reserve() in a deleted record's slot if there is one
+
+    virtual char *locate(RecordID record_id) const;
+
     virtual Dbt *get(RecordID record_id) const;
 
     virtual void put(RecordID record_id, const Dbt &data);
 
     virtual void del(RecordID record_id);
 
+    virtual u_int16_t get_flags(RecordID record_id) const;
+
+    virtual void set_flags(RecordID record_id, u_int16_t flags);  // put() clears them
+
     virtual RecordIDs *ids(void) const;
     
     virtual void clear();
@@ -49,6 +66,8 @@ public:
 
     virtual u_int16_t unused_bytes() const;
 
+    static bool would_fit(uint count, uint bytes);
+
 protected:
     uint16_t num_records;
     uint16_t end_free;
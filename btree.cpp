@@ -3,7 +3,10 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2020"
  */
+#include <algorithm>
+#include <cstring>
 #include "btree.h"
+#include "EvalPlan.h"
 
 BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
                                                                                                               name,
@@ -15,8 +18,6 @@ BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_co
                                                                                                       file(relation.get_table_name() +
                                                                                                            "-" + name),
                                                                                                       key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
     build_key_profile();
 }
 
@@ -47,6 +48,16 @@ void BTreeIndex::drop() {
     file.drop();
 }
 
+// Empty the index in place: its file goes back to just the stat and an empty root leaf.
+void BTreeIndex::truncate() {
+    open();
+    delete stat;
+    delete root;
+    file.truncate();
+    stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
+    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
+}
+
 // Open existing index. Enables: lookup, range, insert, delete, update.
 void BTreeIndex::open() {
     if (closed) {
@@ -56,7 +67,7 @@ void BTreeIndex::open() {
             root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
         else
             root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        closed = false;
     }
 }
 
@@ -73,29 +84,166 @@ void BTreeIndex::close() {
 }
 
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
-// names in the index. Returns a list of row handles.
+// names in the index, or just the leading ones (a prefix of the normalized key, so its matches are a run of
+// adjacent entries). Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    KeyValue *tkey = this->tkey(key_dict);
-    Handles* hs = _lookup(root, stat->get_height(), tkey);
+    bool exact;
+    KeyValue *tkey = lookup_key(key_dict, exact);
+    Handles* hs = _lookup(root, stat->get_height(), tkey, exact);
+    delete tkey;
     return hs;
 }
 
-Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key) const {
+// Normalized key for a lookup, which must give a leading part of the index key; exact is set if it is the whole
+// key of a unique index.
+KeyValue *BTreeIndex::lookup_key(const ValueDict *key_dict, bool &exact) const {
+    uint given = 0;
+    while (given < key_columns.size() && key_dict->find(key_columns[given]) != key_dict->end())
+        given++;
+    for (uint col_num = given + 1; col_num < key_columns.size(); col_num++)
+        if (key_dict->find(key_columns[col_num]) != key_dict->end())
+            throw DbRelationError("lookup needs values for the leading columns of the index key");
+    exact = this->unique && given == key_columns.size();
+    return this->tkey(key_dict);
+}
+
+Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key, bool exact) const {
     if(height == 1){
-        Handles *handles = new Handles();
-        BTreeLeaf *leaf = (BTreeLeaf*)node;
+        return leaf_lookup((BTreeLeaf*)node, key, exact);
+    } else{
+        BTreeInterior* interior_node = (BTreeInterior*)node;
+        BTreeNode *child = interior_node->find(key, height);
+        Handles *handles = this->_lookup(child, height - 1, key, exact);
+        delete child;
+        return handles;
+    }
+}
+
+// Lookup the keys in key order, so that the descents share the nodes they have in common: each node on the way
+// is read once for the whole batch rather than once per key.
+std::vector<Handles *> BTreeIndex::lookup_batch(const ValueDicts &keys) const {
+    Probes probes;
+    for (uint i = 0; i < keys.size(); i++) {
+        Probe probe;
+        probe.key = lookup_key(keys[i], probe.exact);
+        probe.position = i;
+        probes.push_back(probe);
+    }
+    std::stable_sort(probes.begin(), probes.end());
+    std::vector<Handles *> results(keys.size(), nullptr);
+    if (!probes.empty())
+        _lookup_batch(root, stat->get_height(), probes.begin(), probes.end(), results);
+    for (auto const &probe: probes)
+        delete probe.key;
+    return results;
+}
+
+// Lookup the sorted probes from begin to end under node; the probes going down to the same child are a run.
+void BTreeIndex::_lookup_batch(BTreeNode *node, uint height, Probes::const_iterator begin, Probes::const_iterator end,
+                               std::vector<Handles *> &results) const {
+    if (height == 1) {
+        for (auto probe = begin; probe != end; probe++)
+            results[probe->position] = leaf_lookup((BTreeLeaf *) node, probe->key, probe->exact);
+        return;
+    }
+    BTreeInterior *interior_node = (BTreeInterior *) node;
+    while (begin != end) {
+        BlockID down = interior_node->find_child(begin->key);
+        auto run_end = begin + 1;
+        while (run_end != end && interior_node->find_child(run_end->key) == down)
+            run_end++;
+        BTreeNode *child = interior_node->find(begin->key, height);
+        _lookup_batch(child, height - 1, begin, run_end, results);
+        delete child;
+        begin = run_end;
+    }
+}
+
+// The entries for key starting in the given leaf.
+Handles *BTreeIndex::leaf_lookup(BTreeLeaf *leaf, const KeyValue *key, bool exact) {
+    Handles *handles = new Handles();
+    if (exact) {
         if(leaf->contains(key))
             handles->push_back(leaf->find_eq(key));
         return handles;
-    } else{
-        BTreeInterior* interior_node = (BTreeInterior*)node;
-        return this->_lookup(interior_node->find(key, height), height - 1, key);
     }
+    // the entries start where key would go (they are key + the rest of the columns and/or the handle),
+    // and may run on into the next leaves
+    bool more = leaf->find_prefix(key, handles);
+    BTreeLeaf *next = more ? leaf->next() : nullptr;
+    while (next != nullptr) {
+        more = next->find_prefix(key, handles);
+        BTreeLeaf *after = more ? next->next() : nullptr;
+        delete next;
+        next = after;
+    }
+    return handles;
 }
 
 
+// Find all the rows whose keys are from min_key to max_key (inclusive), each of which may give just the leading
+// key columns, or be nullptr for no bound. Starts at the leaf where min_key would go and follows the leaves to
+// the right until a key's leading columns are greater than max_key's.
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
+    KeyValue *tmin = min_key == nullptr ? new KeyValue() : this->tkey(min_key);
+    KeyValue *tmax = max_key == nullptr ? nullptr : this->tkey(max_key);
+    Handles *handles = _range(root, stat->get_height(), tmin, tmax);
+    delete tmin;
+    delete tmax;
+    return handles;
+}
+
+Handles *BTreeIndex::_range(BTreeNode *node, uint height, const KeyValue *min_key, const KeyValue *max_key) const {
+    if (height > 1) {
+        BTreeNode *child = ((BTreeInterior *) node)->find(min_key, height);
+        Handles *handles = _range(child, height - 1, min_key, max_key);
+        delete child;
+        return handles;
+    }
+    Handles *handles = new Handles();
+    bool more = ((BTreeLeaf *) node)->find_range(min_key, max_key, handles);
+    BTreeLeaf *next = more ? ((BTreeLeaf *) node)->next() : nullptr;
+    while (next != nullptr) {
+        more = next->find_range(min_key, max_key, handles);
+        BTreeLeaf *after = more ? next->next() : nullptr;
+        delete next;
+        next = after;
+    }
+    return handles;
+}
+
+// Find the row with the least (or greatest) key: a single descent down the leftmost (or rightmost) edge of the
+// tree. If the leftmost leaf has no entries, the leaves to its right are tried in turn; if the rightmost one has
+// none, this falls back on a range over the whole tree.
+Handles *BTreeIndex::edge(bool greatest) const {
+    Handles *handles = new Handles();
+    BTreeNode *node = root;
+    for (uint height = stat->get_height(); height > 1; height--) {
+        BTreeNode *child = ((BTreeInterior *) node)->edge(greatest, height);
+        if (node != root)
+            delete node;
+        node = child;
+    }
+    Handle handle;
+    bool found = ((BTreeLeaf *) node)->edge(greatest, handle);
+    BTreeLeaf *next = found || greatest ? nullptr : ((BTreeLeaf *) node)->next();
+    while (next != nullptr) {
+        found = next->edge(greatest, handle);
+        BTreeLeaf *after = found ? nullptr : next->next();
+        delete next;
+        next = after;
+    }
+    if (node != root)
+        delete node;
+    if (found) {
+        handles->push_back(handle);
+    } else if (greatest && stat->get_height() > 1) {
+        Handles *all = range(nullptr, nullptr);
+        if (!all->empty())
+            handles->push_back(all->back());
+        delete all;
+    }
+    return handles;
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
@@ -103,7 +251,23 @@ void BTreeIndex::insert(Handle handle) {
     open();
     ValueDict *key = relation.project(handle);
     KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
+    if (!this->unique)
+        BTreeNode::append_key_handle(*tkey, handle);
+    Insertion insertion;
+    try {
+        insertion = _insert(root, stat->get_height(), tkey, handle);
+    } catch (DbBlockNoRoomError &e) {
+        // the cached root may be part way through a split, so read it back
+        delete key;
+        delete tkey;
+        close();
+        open();
+        throw DbRelationError(std::string("index entry doesn't fit: ") + e.what());
+    } catch (...) {
+        delete key;
+        delete tkey;
+        throw;
+    }
     if (!BTreeNode::insertion_is_none(insertion)) {
         auto *new_root = new BTreeInterior(file, 0, key_profile, true);
         new_root->set_first(root->get_id());
@@ -137,13 +301,74 @@ Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key,
 }
 
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
+    del_batch(Handles(1, handle));
+}
+
+/**
+ * Delete the entries for some rows. Their keys are sorted, so each node on the way down to them is read once and
+ * each leaf is saved once.
+ * @param handles  the rows (still in the relation)
+ * @throws         DbRelationError if a row has no entry
+ */
+void BTreeIndex::del_batch(const Handles &handles) {
+    open();
+    Arena arena;
+    Handles rows_handles(handles);
+    ValueDicts *rows = relation.project(&rows_handles, &key_columns, &arena);
+    KeyValues keys;
+    for (uint i = 0; i < rows->size(); i++) {
+        KeyValue *tkey = this->tkey((*rows)[i]);
+        if (!this->unique)
+            BTreeNode::append_key_handle(*tkey, handles[i]);
+        keys.push_back(*tkey);
+        delete tkey;
+    }
+    std::sort(keys.begin(), keys.end());
+    if (!keys.empty())
+        _del_batch(root, stat->get_height(), keys.begin(), keys.end());
+}
+
+// Delete the sorted keys from begin to end under node; the keys going down to the same child are a run.
+void BTreeIndex::_del_batch(BTreeNode *node, uint height, KeyValues::const_iterator begin,
+                            KeyValues::const_iterator end) {
+    if (height == 1) {
+        auto *leaf = (BTreeLeaf *) node;
+        bool found = true;
+        for (auto key = begin; key != end; key++)
+            found = leaf->del(&*key) && found;
+        leaf->save();
+        if (!found)
+            throw DbRelationError("row is missing from index " + name);
+        return;
+    }
+    auto *interior = (BTreeInterior *) node;
+    while (begin != end) {
+        BlockID down = interior->find_child(&*begin);
+        auto run_end = begin + 1;
+        while (run_end != end && interior->find_child(&*run_end) == down)
+            run_end++;
+        BTreeNode *child = interior->find(&*begin, height);
+        try {
+            _del_batch(child, height - 1, begin, run_end);
+        } catch (...) {
+            delete child;
+            throw;
+        }
+        delete child;
+        begin = run_end;
+    }
 }
 
+// Encode the key columns as a normalized key (so the tree compares keys with memcmp). Stops at the first key
+// column missing from key, which leaves the prefix shared by the keys of all rows with those leading values.
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     KeyValue *key_value = new KeyValue();
-    for (auto const &column_name: key_columns)
-        key_value->push_back(key->find(column_name)->second);
+    for (uint col_num = 0; col_num < key_columns.size(); col_num++) {
+        ValueDict::const_iterator column = key->find(key_columns[col_num]);
+        if (column == key->end())
+            break;
+        BTreeNode::append_key_column(*key_value, key_profile[col_num], column->second);
+    }
     return key_value;
 }
 
@@ -160,6 +385,355 @@ void BTreeIndex::build_key_profile() {
         key_profile.push_back(types_by_colname[column_name]);
 }
 
+BTreeRelation::BTreeRelation(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes)
+        : HeapTable(table_name, column_names, column_attributes), key_ordinals(), key_profile(), stat(nullptr) {
+    if (column_names.empty())
+        throw DbRelationError("a btree table needs a primary key column");
+    this->key_ordinals.push_back(0);
+    this->key_profile.push_back(column_attributes[0].get_data_type());
+}
+
+BTreeRelation::~BTreeRelation() {
+    delete stat;
+}
+
+// Create the file with its stat block and an empty root leaf.
+void BTreeRelation::create() {
+    HeapTable::create();
+    create_root();
+}
+
+// Empty the file in place, leaving it as create() does.
+void BTreeRelation::truncate() {
+    open();
+    HeapTable::truncate();
+    delete stat;
+    create_root();
+}
+
+// Give the (empty) file its stat block and an empty root leaf.
+void BTreeRelation::create_root() {
+    stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
+    SlottedPage *root = file.get_new();
+    BlockID no_next = 0;
+    Dbt next_leaf(&no_next, sizeof(no_next));
+    root->add(&next_leaf);
+    file.put(root);
+    delete root;
+}
+
+void BTreeRelation::drop() {
+    HeapTable::drop();
+    delete stat;
+    stat = nullptr;
+}
+
+void BTreeRelation::open() {
+    if (stat == nullptr) {
+        HeapTable::open();
+        stat = new BTreeStat(file, STAT, key_profile);
+    }
+}
+
+void BTreeRelation::close() {
+    HeapTable::close();
+    delete stat;
+    stat = nullptr;
+}
+
+/**
+ * Insert a row into the leaf for its primary key, splitting nodes on the way back up as needed.
+ * @param row  a dictionary with column name keys
+ * @return     the handle of the inserted row
+ * @throws     DbRelationError if there is already a row with the same primary key
+ */
+Handle BTreeRelation::insert(const ValueDict *row) {
+    open();
+    ValueDict *full_row = validate(row);
+    KeyValue key;
+    BTreeNode::append_key_column(key, key_profile[0], full_row->at(column_names[0]));
+    Handle handle;
+    Insertion insertion;
+    try {
+        insertion = _insert(stat->get_root_id(), stat->get_height(), key, full_row, handle);
+    } catch (...) {
+        delete full_row;
+        throw;
+    }
+    delete full_row;
+    if (!BTreeNode::insertion_is_none(insertion)) {
+        BTreeInterior new_root(file, 0, key_profile, true);
+        new_root.set_first(stat->get_root_id());
+        new_root.insert(&insertion.second, insertion.first);
+        stat->set_root_id(new_root.get_id());
+        stat->set_height(stat->get_height() + 1);
+        stat->save();
+    }
+    return handle;
+}
+
+/**
+ * Rewrite a row in its leaf. The row can't leave its leaf, so its primary key can't change and the new record has
+ * to fit where the old one was.
+ * @param handle      the row to be updated
+ * @param new_values  a dictionary with column name keys
+ * @throws            DbRelationError if the primary key would change or the leaf has no room
+ */
+void BTreeRelation::update(const Handle handle, const ValueDict *new_values) {
+    open();
+    ValueDict *row = project(handle);
+    Value key = row->at(column_names[0]);
+    for (auto const &column: *new_values) {
+        if (row->find(column.first) == row->end()) {
+            delete row;
+            throw DbRelationError("unknown column " + column.first);
+        }
+        (*row)[column.first] = column.second;
+    }
+    if (!(row->at(column_names[0]) == key)) {
+        delete row;
+        throw DbRelationError("don't know how to change the primary key of a btree table yet");
+    }
+    Dbt *data;
+    try {
+        data = marshal(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+    SlottedPage *leaf = file.get(handle.first);
+    try {
+        leaf->put(handle.second, *data);
+    } catch (DbBlockNoRoomError &e) {
+        delete leaf;
+        delete[] (char *) data->get_data();
+        delete data;
+        throw DbRelationError("don't know how to split a leaf for an update yet");
+    }
+    file.put(leaf);
+    delete leaf;
+    delete[] (char *) data->get_data();
+    delete data;
+}
+
+/**
+ * Select the rows matching the where clause, in primary key order.
+ * @param where  predicates to match (nullptr for all rows)
+ * @return       list of handles of the selected rows
+ */
+Handles *BTreeRelation::select(const ValueDict *where) {
+    return select(Condition::equalities(where));
+}
+
+/**
+ * Select the first limit rows matching the where clause, in primary key order. (Not a HeapTable scan, which
+ * would read the interior nodes as if they were rows.)
+ * @param where  comparisons that must all hold
+ * @param limit  most handles wanted
+ * @return       list of handles of the selected rows
+ */
+Handles *BTreeRelation::select(const Conjunction &where, size_t limit) {
+    return DbRelation::select(where, limit);
+}
+
+/**
+ * Count the rows from the leaves' headers, following the leaves from the leftmost. (Not a HeapTable count, which
+ * would take the stat and interior nodes for rows.)
+ * @return number of rows in the table
+ */
+size_t BTreeRelation::count() {
+    open();
+    size_t n = 0;
+    BlockID block_id = find_leaf(KeyValue());
+    while (block_id != 0) {
+        SlottedPage *leaf = file.get(block_id);
+        n += leaf->size() - 1;  // all but the next leaf's block id
+        block_id = get_next_leaf(leaf);
+        delete leaf;
+    }
+    return n;
+}
+
+/**
+ * Select the rows matching the where clause, in primary key order. Conditions on the primary key bound the
+ * leaves that are looked at: the walk starts at the leaf for the least key they allow and stops after the
+ * greatest (so an equality only looks in one leaf).
+ * @param where  comparisons that must all hold
+ * @return       list of handles of the selected rows
+ */
+Handles *BTreeRelation::select(const Conjunction &where) {
+    open();
+    Handles *handles = new Handles();
+    RecordMatcher matcher(this->codec, where);
+    KeyValue low, high;
+    bool bounded_below = false, bounded_above = false;
+    for (auto const &condition: where) {
+        if (condition.column_name != column_names[0])
+            continue;
+        // the least and greatest keys this condition allows
+        KeyValue least, greatest;
+        bool has_least = false, has_greatest = false;
+        for (uint i = 0; i < condition.operands.size(); i++) {
+            const Value &operand = condition.operands[i];
+            if (operand.data_type != key_profile[0])
+                continue;  // never matches (see RecordMatcher)
+            KeyValue key;
+            BTreeNode::append_key_column(key, key_profile[0], operand);
+            bool lower = condition.comparison == Condition::GT || condition.comparison == Condition::GE ||
+                         (condition.comparison == Condition::BETWEEN && i == 0);
+            bool upper = condition.comparison == Condition::LT || condition.comparison == Condition::LE ||
+                         (condition.comparison == Condition::BETWEEN && i == 1);
+            if (condition.comparison == Condition::EQ || condition.comparison == Condition::IN)
+                lower = upper = true;
+            if (lower && (!has_least || key < least)) {
+                least = key;
+                has_least = true;
+            }
+            if (upper && (!has_greatest || greatest < key)) {
+                greatest = key;
+                has_greatest = true;
+            }
+        }
+        if (has_least && (!bounded_below || low < least)) {
+            low = least;
+            bounded_below = true;
+        }
+        if (has_greatest && (!bounded_above || greatest < high)) {
+            high = greatest;
+            bounded_above = true;
+        }
+    }
+
+    BlockID block_id = find_leaf(low);
+    while (block_id != 0) {
+        SlottedPage *leaf = file.get(block_id);
+        for (auto const &entry: leaf_entries(leaf)) {
+            if (bounded_above && high < entry.first) {
+                delete leaf;
+                return handles;
+            }
+            if (entry.first >= low && matcher.matches(leaf->locate(entry.second)))
+                handles->push_back(Handle(block_id, entry.second));
+        }
+        block_id = get_next_leaf(leaf);
+        delete leaf;
+    }
+    return handles;
+}
+
+// The normalized primary key of a marshaled row (the key is the first column, so it starts the record).
+KeyValue BTreeRelation::record_key(const char *record) const {
+    Value value;
+    if (key_profile[0] == ColumnAttribute::TEXT)
+        value = Value(record + sizeof(u_int16_t), *(u_int16_t *) record);
+    else if (key_profile[0] == ColumnAttribute::INT)
+        value.n = *(int32_t *) record;
+    else
+        value.n = *(uint8_t *) record;
+    KeyValue key;
+    BTreeNode::append_key_column(key, key_profile[0], value);
+    return key;
+}
+
+// The rows in a leaf as (primary key, record id), sorted by key.
+BTreeRelation::LeafEntries BTreeRelation::leaf_entries(SlottedPage *leaf) const {
+    LeafEntries entries;
+    RecordIDs *record_ids = leaf->ids();
+    for (auto const &record_id: *record_ids)
+        if (record_id != NEXT_LEAF)
+            entries.push_back(LeafEntry(record_key(leaf->locate(record_id)), record_id));
+    delete record_ids;
+    sort(entries.begin(), entries.end());
+    return entries;
+}
+
+BlockID BTreeRelation::get_next_leaf(SlottedPage *leaf) {
+    return *(BlockID *) leaf->locate(NEXT_LEAF);
+}
+
+// Descend from the root to the leaf whose range holds key.
+BlockID BTreeRelation::find_leaf(const KeyValue &key) {
+    BlockID block_id = stat->get_root_id();
+    for (uint height = stat->get_height(); height > 1; height--) {
+        BTreeInterior interior(file, block_id, key_profile, false);
+        block_id = interior.find_child(&key);
+    }
+    return block_id;
+}
+
+Insertion BTreeRelation::_insert(BlockID block_id, uint height, const KeyValue &key, const ValueDict *row,
+                                 Handle &handle) {
+    if (height == 1)
+        return leaf_insert(block_id, key, row, handle);
+    BTreeInterior interior(file, block_id, key_profile, false);
+    Insertion insertion = _insert(interior.find_child(&key), height - 1, key, row, handle);
+    if (!BTreeNode::insertion_is_none(insertion))
+        insertion = interior.insert(&insertion.second, insertion.first);
+    return insertion;
+}
+
+// Put the row in the given leaf, in the slot of a deleted row if there is one (nothing refers to a deleted row,
+// and this way rows coming and going don't fill the leaf with their slots). If it doesn't fit, the upper half
+// of the leaf's rows (by key) move to a new leaf to its right, and the separator between the halves goes back
+// up to the parent.
+Insertion BTreeRelation::leaf_insert(BlockID block_id, const KeyValue &key, const ValueDict *row, Handle &handle) {
+    u_int16_t size = codec.size(row);
+    SlottedPage *leaf = file.get(block_id);
+    LeafEntries entries = leaf_entries(leaf);
+    if (binary_search(entries.begin(), entries.end(), LeafEntry(key, 0),
+                      [](const LeafEntry &a, const LeafEntry &b) { return a.first < b.first; })) {
+        delete leaf;
+        throw DbRelationError("Duplicate keys are not allowed in primary key");
+    }
+    try {
+        RecordID record_id = leaf->reuse(size);
+        codec.marshal(row, leaf->locate(record_id));
+        file.put(leaf);
+        delete leaf;
+        handle = Handle(block_id, record_id);
+        return BTreeNode::insertion_none();
+    } catch (DbBlockNoRoomError &e) {
+        // split below
+    }
+    if (entries.size() < 2) {
+        delete leaf;
+        throw DbRelationError("row too big for a btree leaf");
+    }
+
+    SlottedPage *nleaf = file.get_new();
+    BlockID nleaf_id = nleaf->get_block_id();
+    BlockID next_leaf = get_next_leaf(leaf);
+    Dbt next(&next_leaf, sizeof(next_leaf));
+    nleaf->add(&next);
+    memcpy(leaf->locate(NEXT_LEAF), &nleaf_id, sizeof(nleaf_id));
+    size_t split = entries.size() / 2;
+    for (size_t i = split; i < entries.size(); i++) {
+        Dbt *data = leaf->get(entries[i].second);
+        nleaf->add(data);
+        delete data;
+        leaf->del(entries[i].second);
+    }
+    KeyValue boundary = BTreeNode::shortest_separator(entries[split - 1].first, entries[split].first);
+
+    SlottedPage *target = key < boundary ? leaf : nleaf;
+    RecordID record_id;
+    try {
+        record_id = target->reuse(size);
+    } catch (DbBlockNoRoomError &e) {
+        delete leaf;
+        delete nleaf;
+        throw DbRelationError("row too big for a btree leaf");
+    }
+    codec.marshal(row, target->locate(record_id));
+    handle = Handle(target->get_block_id(), record_id);
+    file.put(nleaf);
+    file.put(leaf);
+    delete leaf;
+    delete nleaf;
+    return Insertion(nleaf_id, boundary);
+}
+
 bool test_btree() {
     ColumnNames column_names;
     column_names.push_back("a");
@@ -246,6 +820,487 @@ bool test_btree() {
         }
     }
 
+    // lookups on just the leading column of a composite key
+    column_names.clear();
+    column_names.push_back("a");
+    column_names.push_back("b");
+    BTreeIndex abindex(table, "abindex", column_names, true);
+    abindex.create();
+    ValueDict ablookup;
+    ablookup["a"] = 12;
+    handles = abindex.lookup(&ablookup);
+    result = handles->size() == 1 ? table.project(handles->back()) : nullptr;
+    if (result == nullptr || result->at("b") != Value(99)) {
+        std::cout << "composite prefix lookup failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    delete result;
+    ablookup["b"] = 99;
+    handles = abindex.lookup(&ablookup);
+    u_long full_matches = handles->size();
+    delete handles;
+    ablookup["b"] = 98;
+    handles = abindex.lookup(&ablookup);
+    if (full_matches != 1 || handles->size() != 0) {
+        std::cout << "composite full lookup failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    std::cout << "composite prefix lookups ok" << std::endl;
+    abindex.drop();
+
+    // negative keys sort below positive ones
+    column_names.clear();
+    column_names.push_back("b");
+    BTreeIndex bindex(table, "barindex", column_names, true);
+    bindex.create();
+    for (int b: {-49999, -1, 0, 99, 101}) {
+        ValueDict blookup;
+        blookup["b"] = b;
+        handles = bindex.lookup(&blookup);
+        if (handles->size() != 1) {
+            std::cout << "lookup of b=" << b << " failed" << std::endl;
+            return false;
+        }
+        result = table.project(handles->back());
+        if (result->at("b") != Value(b)) {
+            std::cout << "lookup of b=" << b << " failed" << std::endl;
+            return false;
+        }
+        delete handles;
+        delete result;
+    }
+    std::cout << "negative key lookups ok" << std::endl;
+    bindex.drop();
+
+    // ranges: inclusive bounds on the leading key column, and the matching scans with comparisons
+    ValueDict min_key, max_key;
+    min_key["a"] = 100;
+    max_key["a"] = 309;
+    handles = index.range(&min_key, &max_key);
+    if (handles->size() != 210) {
+        std::cout << "range failed: " << handles->size() << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 210; i++) {
+        result = table.project(handles->at(i));
+        if (result->at("a") != Value(100 + i)) {
+            std::cout << "range out of order at " << i << std::endl;
+            return false;
+        }
+        delete result;
+    }
+    delete handles;
+    handles = index.range(nullptr, &min_key);
+    if (handles->size() != 3) {  // 12, 88 and 100
+        std::cout << "open-ended range failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    Conjunction between;
+    between.push_back(Condition("a", Condition::GE, Value(100)));
+    between.push_back(Condition("a", Condition::LT, Value(310)));
+    handles = table.select(between);
+    if (handles->size() != 210) {
+        std::cout << "scan with comparisons failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    Conjunction in_list;
+    std::vector<Value> listed = {Value(12), Value(-5), Value(88), Value(5000)};
+    in_list.push_back(Condition("a", Condition::IN, listed));
+    handles = table.select(in_list);
+    if (handles->size() != 3) {
+        std::cout << "scan with IN failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    std::cout << "ranges ok" << std::endl;
+
+    // the least and greatest keys from the ends of the tree, and the row count from the block headers
+    handles = index.edge(false);
+    if (handles->size() != 1) {
+        std::cout << "least key failed" << std::endl;
+        return false;
+    }
+    result = table.project(handles->front());
+    if (result->at("a") != Value(12)) {
+        std::cout << "least key failed" << std::endl;
+        return false;
+    }
+    delete result;
+    delete handles;
+    handles = index.edge(true);
+    if (handles->size() != 1) {
+        std::cout << "greatest key failed" << std::endl;
+        return false;
+    }
+    result = table.project(handles->front());
+    if (result->at("a") != Value(50099)) {
+        std::cout << "greatest key failed" << std::endl;
+        return false;
+    }
+    delete result;
+    delete handles;
+    if (table.count() != 50002) {
+        std::cout << "count failed: " << table.count() << std::endl;
+        return false;
+    }
+    std::cout << "edges and count ok" << std::endl;
+
+    // handle sets combined as bitmaps come back in block order
+    Handles *ranged = index.range(&min_key, &max_key);
+    Conjunction upper;
+    upper.push_back(Condition("a", Condition::GE, Value(200)));
+    Handles *scanned = table.select(upper);
+    HandleBitmap both(*ranged), either(*ranged);
+    both.intersect(HandleBitmap(*scanned));
+    either.unite(HandleBitmap(*scanned));
+    delete ranged;
+    delete scanned;
+    handles = both.handles();
+    if (handles->size() != 110 || !std::is_sorted(handles->begin(), handles->end())) {
+        std::cout << "bitmap intersection failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    handles = either.handles();
+    if (handles->size() != 50000 || !std::is_sorted(handles->begin(), handles->end())) {
+        std::cout << "bitmap union failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    std::vector<EvalPlan *> searches;
+    searches.push_back(new EvalPlan(index, new ValueDict(min_key), new ValueDict(max_key), table));
+    ValueDict *point = new ValueDict();
+    (*point)["a"] = 250;
+    searches.push_back(new EvalPlan(index, point, table));
+    EvalPlan *bitmap_and = new EvalPlan(EvalPlan::BitmapAnd, searches, table);
+    EvalPipeline pipeline = bitmap_and->pipeline();
+    delete bitmap_and;
+    if (pipeline.second->size() != 1) {
+        std::cout << "bitmap and plan failed: " << pipeline.second->size() << std::endl;
+        return false;
+    }
+    delete pipeline.second;
+    std::cout << "bitmaps ok" << std::endl;
+
+    // a batch of lookups, out of order and with repeated and missing keys, finds what one lookup at a time does
+    ValueDicts batch;
+    for (int a: {50099, 12, 5000, -3, 12, 777, 88, 100, 40000}) {
+        ValueDict *batch_key = new ValueDict();
+        (*batch_key)["a"] = a;
+        batch.push_back(batch_key);
+    }
+    std::vector<Handles *> batch_results = index.lookup_batch(batch);
+    for (uint i = 0; i < batch.size(); i++) {
+        handles = index.lookup(batch[i]);
+        if (*handles != *batch_results[i] || handles->size() != (batch[i]->at("a") == Value(-3) ? 0 : 1)) {
+            std::cout << "batch lookup of a=" << batch[i]->at("a").n << " failed" << std::endl;
+            return false;
+        }
+        delete handles;
+        delete batch_results[i];
+        delete batch[i];
+    }
+    std::cout << "batch lookups ok" << std::endl;
+
+    // text keys with long common prefixes (compressed in the leaves, truncated in the interior nodes)
+    ColumnNames text_column_names;
+    text_column_names.push_back("email");
+    ColumnAttributes text_column_attributes;
+    text_column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable text_table("__test_btree_text", text_column_names, text_column_attributes);
+    text_table.create();
+    for (int i = 0; i < 5000; i++) {
+        ValueDict row;
+        row["email"] = Value("customer" + std::to_string(i * 7919 % 5000) + "@example.com");
+        text_table.insert(&row);
+    }
+    BTreeIndex text_index(text_table, "emailindex", text_column_names, true);
+    text_index.create();
+    for (int i = 0; i < 5000; i += 37) {
+        ValueDict text_lookup;
+        text_lookup["email"] = Value("customer" + std::to_string(i) + "@example.com");
+        handles = text_index.lookup(&text_lookup);
+        if (handles->size() != 1) {
+            std::cout << "text lookup " << i << " failed" << std::endl;
+            return false;
+        }
+        result = text_table.project(handles->back());
+        if (*result != text_lookup) {
+            std::cout << "text lookup " << i << " failed" << std::endl;
+            return false;
+        }
+        delete handles;
+        delete result;
+    }
+    ValueDict text_lookup;
+    text_lookup["email"] = Value("customer@example.com");
+    handles = text_index.lookup(&text_lookup);
+    if (handles->size() != 0) {
+        std::cout << "missing text lookup failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    std::cout << "text key lookups ok" << std::endl;
+    text_index.drop();
+
+    // a few short keys and a few near the size limit, so the first leaf has to split by bytes, not entries;
+    // then many more short keys, and keys with a long common prefix (dense leaves, but separators near the size
+    // limit), so the interior nodes do too
+    HeapTable skew_table("__test_btree_skew", text_column_names, text_column_attributes);
+    skew_table.create();
+    std::vector<std::string> skew_keys;
+    for (int i = 1; i <= 4; i++)
+        skew_keys.push_back("a" + std::to_string(i));
+    for (char c = 'b'; c <= 'e'; c++)
+        skew_keys.push_back(std::string(1020, c));
+    for (int i = 0; i < 3000; i++)
+        skew_keys.push_back("f" + std::to_string(10000 + i));
+    for (int i = 0; i < 2000; i++)
+        skew_keys.push_back(std::string(1000, 'g') + std::to_string(10000 + i));
+    for (auto const &skew_key: skew_keys) {
+        ValueDict row;
+        row["email"] = Value(skew_key);
+        skew_table.insert(&row);
+    }
+    BTreeIndex skew_index(skew_table, "skewindex", text_column_names, true);
+    try {
+        skew_index.create();
+    } catch (DbRelationError &e) {
+        std::cout << "skewed key insert failed: " << e.what() << std::endl;
+        return false;
+    }
+    for (uint i = 0; i < skew_keys.size(); i += i < 8 ? 1 : 97) {
+        std::string &skew_key = skew_keys[i];
+        ValueDict skew_lookup;
+        skew_lookup["email"] = Value(skew_key);
+        handles = skew_index.lookup(&skew_lookup);
+        if (handles->size() != 1) {
+            std::cout << "skewed key lookup " << i << " failed" << std::endl;
+            return false;
+        }
+        result = skew_table.project(handles->back());
+        if (*result != skew_lookup) {
+            std::cout << "skewed key lookup " << i << " failed" << std::endl;
+            return false;
+        }
+        delete handles;
+        delete result;
+    }
+    std::cout << "skewed key lookups ok" << std::endl;
+    skew_index.drop();
+    skew_table.drop();
+
+    // duplicate keys in a non-unique index (spanning several leaves)
+    for (int i = 0; i < 1000; i++) {
+        ValueDict row;
+        row["email"] = Value("customer42@example.com");
+        text_table.insert(&row);
+    }
+    BTreeIndex dup_index(text_table, "dupindex", text_column_names, false);
+    dup_index.create();
+    text_lookup["email"] = Value("customer42@example.com");
+    handles = dup_index.lookup(&text_lookup);
+    if (handles->size() != 1001) {
+        std::cout << "duplicate key lookup failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    text_lookup["email"] = Value("customer43@example.com");
+    handles = dup_index.lookup(&text_lookup);
+    if (handles->size() != 1) {
+        std::cout << "lookup next to duplicates failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    std::cout << "duplicate key lookups ok" << std::endl;
+
+    // deleting entries: every other duplicate in one batch (across the leaves), then a single entry
+    text_lookup["email"] = Value("customer42@example.com");
+    handles = dup_index.lookup(&text_lookup);
+    Handles doomed;
+    for (uint i = 0; i < handles->size(); i += 2)
+        doomed.push_back((*handles)[i]);
+    delete handles;
+    dup_index.del_batch(doomed);
+    handles = dup_index.lookup(&text_lookup);
+    if (handles->size() != 500) {
+        std::cout << "batch delete failed: " << handles->size() << std::endl;
+        return false;
+    }
+    dup_index.del(handles->front());
+    delete handles;
+    handles = dup_index.lookup(&text_lookup);
+    if (handles->size() != 499 || std::find(handles->begin(), handles->end(), doomed.back()) != handles->end()) {
+        std::cout << "delete failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    text_lookup["email"] = Value("customer43@example.com");
+    handles = dup_index.lookup(&text_lookup);
+    if (handles->size() != 1) {
+        std::cout << "lookup after deletes failed: " << handles->size() << std::endl;
+        return false;
+    }
+    dup_index.del(handles->front());
+    delete handles;
+    handles = dup_index.lookup(&text_lookup);
+    if (!handles->empty()) {
+        std::cout << "last entry delete failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    std::cout << "deletes ok" << std::endl;
+    dup_index.drop();
+    text_table.drop();
+
+    // rows clustered in a btree on their primary key (the first column)
+    ColumnNames rel_column_names;
+    rel_column_names.push_back("id");
+    rel_column_names.push_back("name");
+    ColumnAttributes rel_column_attributes;
+    rel_column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    rel_column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    BTreeRelation relation("__test_btree_rel", rel_column_names, rel_column_attributes);
+    relation.create();
+    for (int i = 0; i < 20000; i++) {
+        ValueDict row;
+        row["id"] = Value(i * 7919 % 20000 - 10000);
+        row["name"] = Value("name " + std::to_string(i * 7919 % 20000 - 10000));
+        relation.insert(&row);
+    }
+    handles = relation.select();
+    ValueDicts *rows = relation.project(handles);
+    delete handles;
+    if (rows->size() != 20000) {
+        std::cout << "btree relation scan failed: " << rows->size() << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 20000; i++) {
+        if (rows->at(i)->at("id") != Value(i - 10000)) {
+            std::cout << "btree relation scan out of order at " << i << std::endl;
+            return false;
+        }
+        delete rows->at(i);
+    }
+    delete rows;
+    Conjunction id_range;
+    id_range.push_back(Condition("id", Condition::BETWEEN, std::vector<Value>{Value(-20), Value(20)}));
+    id_range.push_back(Condition("id", Condition::GT, Value(-10)));
+    handles = relation.select(id_range);
+    if (handles->size() != 30) {
+        std::cout << "btree relation range failed: " << handles->size() << std::endl;
+        return false;
+    }
+    result = relation.project(handles->front());
+    if (result->at("id") != Value(-9)) {
+        std::cout << "btree relation range started at the wrong row" << std::endl;
+        return false;
+    }
+    delete result;
+    delete handles;
+    ValueDict rel_where;
+    for (int id = -10000; id < 10000; id += 997) {
+        rel_where["id"] = Value(id);
+        handles = relation.select(&rel_where);
+        if (handles->size() != 1) {
+            std::cout << "btree relation lookup " << id << " failed" << std::endl;
+            return false;
+        }
+        result = relation.project(handles->back());
+        if (result->at("name") != Value("name " + std::to_string(id))) {
+            std::cout << "btree relation lookup " << id << " found the wrong row" << std::endl;
+            return false;
+        }
+        delete result;
+        delete handles;
+    }
+    rel_where["id"] = Value(42);
+    rel_where["name"] = Value("name 42");
+    try {
+        relation.insert(&rel_where);
+        std::cout << "btree relation allowed a duplicate key" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {}
+    handles = relation.select(&rel_where);
+    relation.del(handles->back());
+    delete handles;
+    handles = relation.select(&rel_where);
+    if (handles->size() != 0) {
+        std::cout << "btree relation delete failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    if (relation.count() != 19999) {
+        std::cout << "btree relation count failed: " << relation.count() << std::endl;
+        return false;
+    }
+    std::cout << "btree relation ok" << std::endl;
+
+    // truncating leaves each file as create() does
+    relation.truncate();
+    index.truncate();
+    if (relation.count() != 0 || table.count() != 50002) {
+        std::cout << "truncate failed: " << relation.count() << std::endl;
+        return false;
+    }
+    ValueDict rel_row;
+    rel_row["id"] = Value(7);
+    rel_row["name"] = Value("seven");
+    relation.insert(&rel_row);
+    handles = relation.select(&rel_row);
+    if (handles->size() != 1 || relation.count() != 1) {
+        std::cout << "insert after truncate failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    lookup["a"] = 12;
+    handles = index.lookup(&lookup);
+    if (!handles->empty()) {
+        std::cout << "index truncate failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    index.insert(Handle(1, 1));  // row1 again
+    handles = index.lookup(&lookup);
+    if (handles->size() != 1) {
+        std::cout << "index insert after truncate failed" << std::endl;
+        return false;
+    }
+    delete handles;
+    std::cout << "truncate ok" << std::endl;
+
+    // a row coming and going over and over next to another one in a leaf takes the same slot each time
+    rel_row["id"] = Value(8);
+    rel_row["name"] = Value("eight");
+    for (int i = 0; i < 2000; i++) {
+        try {
+            relation.insert(&rel_row);
+        } catch (DbRelationError &e) {
+            std::cout << "btree relation insert " << i << " after deletes failed: " << e.what() << std::endl;
+            return false;
+        }
+        handles = relation.select(&rel_row);
+        relation.del(handles->back());
+        delete handles;
+    }
+    rel_row["name"] = Value("eight, and longer than it was");
+    relation.insert(&rel_row);
+    handles = relation.select();
+    if (handles->size() != 2) {
+        std::cout << "btree relation churn failed: " << handles->size() << std::endl;
+        return false;
+    }
+    ValueDict longer;
+    longer["name"] = Value("seven, and longer than it was too");
+    relation.update(handles->front(), &longer);
+    delete handles;
+    std::cout << "btree relation churn ok" << std::endl;
+    relation.drop();
+
     index.drop();
     table.drop();
     return true;
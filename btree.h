@@ -18,19 +18,31 @@ public:
 
     virtual void drop();
 
+    virtual void truncate();
+
     virtual void open();
 
     virtual void close();
 
     virtual Handles *lookup(ValueDict *key) const;
 
+    virtual std::vector<Handles *> lookup_batch(const ValueDicts &keys) const;
+
+    virtual uint min_lookup_columns() const { return 1; }
+
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
 
+    virtual bool has_range() const { return true; }
+
+    virtual Handles *edge(bool greatest) const;
+
     virtual void insert(Handle handle);
 
     virtual void del(Handle handle);
 
-    virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
+    virtual void del_batch(const Handles &handles);
+
+    virtual KeyValue *tkey(const ValueDict *key) const; // normalized key (or leading part) from the ValueDict
 
 protected:
     static const BlockID STAT = 1;
@@ -40,11 +52,96 @@ protected:
     HeapFile file;
     KeyProfile key_profile;
 
+    // one key of a lookup_batch
+    struct Probe {
+        KeyValue *key;
+        bool exact;     // whole key of a unique index (so at most one entry)
+        uint position;  // in the batch
+
+        bool operator<(const Probe &other) const { return *key < *other.key; }
+    };
+    typedef std::vector<Probe> Probes;
+
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    KeyValue *lookup_key(const ValueDict *key_dict, bool &exact) const;
+
+    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key, bool exact) const;
+
+    void _lookup_batch(BTreeNode *node, uint height, Probes::const_iterator begin, Probes::const_iterator end,
+                       std::vector<Handles *> &results) const;
+
+    static Handles *leaf_lookup(BTreeLeaf *leaf, const KeyValue *key, bool exact);
+
+    Handles *_range(BTreeNode *node, uint height, const KeyValue *min_key, const KeyValue *max_key) const;
 
     Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+
+    void _del_batch(BTreeNode *node, uint height, KeyValues::const_iterator begin, KeyValues::const_iterator end);
+};
+
+/**
+ * @class BTreeRelation - index-organized table: the rows themselves are kept in the leaves of a B+ tree on the
+ * primary key (the first column), so a key lookup reads one leaf and a scan returns the rows in key order.
+ *
+ * The blocks are SlottedPages in the relation's HeapFile, so the records are marshaled by the table's codec
+ * exactly as in a HeapTable and handles, projection and deletion work the same way. Block 1 holds the BTreeStat,
+ * interior nodes are BTreeInteriors, and in a leaf record 1 is the next leaf's block id and the rest are rows
+ * (in no particular order within the leaf). Record ids stay put until the leaf splits, since deleting a row
+ * leaves a tombstone in its slot.
+ */
+class BTreeRelation : public HeapTable {
+public:
+    BTreeRelation(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+
+    virtual ~BTreeRelation();
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handle insert(const ValueDict *row);
+
+    virtual void update(const Handle handle, const ValueDict *new_values);
+
+    virtual Handles *select(const ValueDict *where);
+
+    virtual Handles *select(const Conjunction &where);
+
+    virtual Handles *select(const Conjunction &where, size_t limit);
+
+    virtual size_t count();
+
+    virtual void truncate();
+
+    using HeapTable::select;
+
+protected:
+    typedef std::pair<KeyValue, RecordID> LeafEntry;
+    typedef std::vector<LeafEntry> LeafEntries;
+    static const BlockID STAT = 1;
+    static const RecordID NEXT_LEAF = 1;
+    ColumnOrdinals key_ordinals;
+    KeyProfile key_profile;
+    BTreeStat *stat;
+
+    void create_root();
+
+    KeyValue record_key(const char *record) const;
+
+    LeafEntries leaf_entries(SlottedPage *leaf) const;
+
+    static BlockID get_next_leaf(SlottedPage *leaf);
+
+    BlockID find_leaf(const KeyValue &key);
+
+    Insertion _insert(BlockID block_id, uint height, const KeyValue &key, const ValueDict *row, Handle &handle);
+
+    Insertion leaf_insert(BlockID block_id, const KeyValue &key, const ValueDict *row, Handle &handle);
 };
 
 bool test_btree();
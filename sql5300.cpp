@@ -6,11 +6,13 @@
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "db_cxx.h"
 #include "SQLParser.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "EvalPlan.h"
 
 using namespace std;
 using namespace hsql;
@@ -46,25 +48,53 @@ int main(int argc, char *argv[]) {
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_eval_plan: " << (test_eval_plan() ? "ok" : "failed") << endl;
+            cout << "test_sql_exec: " << (test_sql_exec() ? "ok" : "failed") << endl;
             continue;
         }
 
-        // parse and execute
-        SQLParserResult *parse = SQLParser::parseSQLString(query);
-        if (!parse->isValid()) {
-            cout << "invalid SQL: " << query << endl;
-            cout << parse->errorMsg() << endl;
+        // parse and execute (the parser doesn't know about CREATE TABLE's WITH clause, so take that off first)
+        TableOptions options;
+        bool has_options;
+        try {
+            has_options = SQLExec::extract_table_options(query, options);
+        } catch (SQLExecError &e) {
+            cout << "Error: " << e.what() << endl;
+            continue;
+        }
+        // a line like one run before (but for its literals) comes out of the statement cache without being parsed
+        vector<const SQLStatement *> statements;
+        SQLParserResult *parse = nullptr;
+        const SQLStatement *cached = has_options ? nullptr : SQLExec::parse_cached(query);
+        if (cached != nullptr) {
+            statements.push_back(cached);
         } else {
-            for (uint i = 0; i < parse->size(); ++i) {
-                const SQLStatement *statement = parse->getStatement(i);
-                try {
-                    cout << ParseTreeToString::statement(statement) << endl;
-                    QueryResult *result = SQLExec::execute(statement);
-                    cout << *result << endl;
-                    delete result;
-                } catch (SQLExecError &e) {
-                    cout << "Error: " << e.what() << endl;
+            parse = SQLParser::parseSQLString(query);
+            if (!parse->isValid()) {
+                cout << "invalid SQL: " << query << endl;
+                cout << parse->errorMsg() << endl;
+            } else {
+                for (uint i = 0; i < parse->size(); ++i)
+                    statements.push_back(parse->getStatement(i));
+            }
+        }
+        for (auto const statement: statements) {
+            try {
+                cout << ParseTreeToString::statement(statement);
+                if (has_options) {
+                    string separator = " WITH (";
+                    for (auto const &option: options) {
+                        cout << separator << option.first << "=" << option.second;
+                        separator = ", ";
+                    }
+                    cout << ")";
                 }
+                cout << endl;
+                QueryResult *result = SQLExec::execute(statement, has_options ? &options : nullptr);
+                cout << *result << endl;
+                delete result;
+            } catch (SQLExecError &e) {
+                cout << "Error: " << e.what() << endl;
             }
         }
         delete parse;
@@ -6,39 +6,90 @@
 #include <algorithm>
 #include "storage_engine.h"
 
-bool Value::operator==(const Value &other) const {
-    if (this->data_type != other.data_type)
-        return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
-}
-
-bool Value::operator!=(const Value &other) const {
-    return !(*this == other);
-}
-
-bool Value::operator<(const Value &other) const {
-    if (this->data_type != other.data_type) {
-        // arbitrary ordering of data types: BOOLEAN < INT < TEXT
-        if (this->data_type == ColumnAttribute::BOOLEAN)
-            return true;
-        if (other.data_type == ColumnAttribute::BOOLEAN)
-            return false;
-        if (this->data_type == ColumnAttribute::INT)
-            return true;
-        if (other.data_type == ColumnAttribute::INT)
-            return false;
-        return false; // should never reach this
+Value::Value(const char *chars, size_t size, Arena *arena) : data_type(ColumnAttribute::TEXT), rep(INLINE),
+                                                              length((uint16_t) size) {
+    if (size > UINT16_MAX)
+        throw std::length_error("text value too long");
+    if (size <= INLINE_SZ) {
+        memcpy(this->text, chars, size);
+        return;
     }
-    if (this->data_type == ColumnAttribute::TEXT)
-        return this->s < other.s;
-    return this->n < other.n;
+    memcpy(this->text, chars, PREFIX_SZ);
+    if (arena != nullptr) {
+        this->rep = BORROWED;
+        set_text_pointer(arena->intern(chars, size));
+    } else {
+        this->rep = OWNED;
+        char *copy = new char[size];
+        memcpy(copy, chars, size);
+        set_text_pointer(copy);
+    }
+}
+
+Value::Value(const Value &other) : data_type(other.data_type), rep(INLINE), length(0), n(0) {
+    copy_text(other);
+}
+
+// Steals an owned string from temp, leaving it an empty inline one.
+Value::Value(Value &&temp) noexcept : data_type(temp.data_type), rep(temp.rep), length(temp.length) {
+    memcpy(this->text, temp.text, INLINE_SZ);
+    temp.rep = INLINE;
+    temp.length = 0;
+}
+
+Value &Value::operator=(const Value &other) {
+    if (this != &other) {
+        this->~Value();
+        this->data_type = other.data_type;
+        copy_text(other);
+    }
+    return *this;
+}
+
+Value &Value::operator=(Value &&temp) noexcept {
+    if (this != &temp) {
+        this->~Value();
+        this->data_type = temp.data_type;
+        this->rep = temp.rep;
+        this->length = temp.length;
+        memcpy(this->text, temp.text, INLINE_SZ);
+        temp.rep = INLINE;
+        temp.length = 0;
+    }
+    return *this;
+}
+
+// Take on other's payload (data_type already set); only owned strings need a deep copy.
+void Value::copy_text(const Value &other) {
+    this->rep = other.rep;
+    this->length = other.length;
+    memcpy(this->text, other.text, INLINE_SZ);
+    if (this->data_type == ColumnAttribute::TEXT && this->rep == OWNED) {
+        char *copy = new char[this->length];
+        memcpy(copy, other.text_pointer(), this->length);
+        set_text_pointer(copy);
+    }
+}
+
+// Three-way comparison of two TEXT values, trying the inline prefixes before the full strings.
+int Value::text_compare(const Value &other) const {
+    uint16_t common = this->length < other.length ? this->length : other.length;
+    int cmp = memcmp(this->text, other.text, common < PREFIX_SZ ? common : PREFIX_SZ);
+    if (cmp != 0)
+        return cmp;
+    const char *mine = text_data();
+    const char *theirs = other.text_data();
+    if (mine != theirs && common > PREFIX_SZ) {
+        cmp = memcmp(mine + PREFIX_SZ, theirs + PREFIX_SZ, common - PREFIX_SZ);
+        if (cmp != 0)
+            return cmp;
+    }
+    return (int) this->length - (int) other.length;
 }
 
 std::ostream &operator<<(std::ostream &out, const Value &value) {
     if (value.data_type == ColumnAttribute::DataType::TEXT)
-        out << value.s;
+        out.write(value.text_data(), value.text_size());
     else if (value.data_type == ColumnAttribute::DataType::INT)
         out << value.n;
     else if (value.n)
@@ -48,6 +99,14 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
     return out;
 }
 
+Conjunction Condition::equalities(const ValueDict *where) {
+    Conjunction conjunction;
+    if (where != nullptr)
+        for (auto const &column: *where)
+            conjunction.push_back(Condition(column.first, EQ, column.second));
+    return conjunction;
+}
+
 // Get only selected column attributes
 ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -71,29 +130,56 @@ ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     return this->project(handle, &t);
 }
 
-// Do a projection for each of a list of handles
-ValueDicts *DbRelation::project(Handles *handles) {
-    ValueDicts *ret = new ValueDicts();
+// Select them all, then keep the first limit of them.
+Handles *DbRelation::select(const Conjunction &where, size_t limit) {
+    Handles *handles = select(where);
+    if (handles->size() > limit)
+        handles->resize(limit);
+    return handles;
+}
+
+// Select them all and count them.
+size_t DbRelation::count() {
+    Handles *handles = select();
+    size_t n = handles->size();
+    delete handles;
+    return n;
+}
+
+// Delete them all, one at a time.
+void DbRelation::truncate() {
+    Handles *handles = select();
     for (auto const &handle: *handles)
-        ret->push_back(project(handle));
-    return ret;
+        del(handle);
+    delete handles;
 }
 
 // Do a projection for each of a list of handles
-ValueDicts *DbRelation::project(Handles *handles, const ColumnNames *column_names) {
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle, column_names));
+ValueDicts *DbRelation::project(Handles *handles, Arena *arena) {
+    return project(handles, &this->column_names, arena);
+}
+
+// Do a projection for each of a list of handles
+ValueDicts *DbRelation::project(Handles *handles, const ColumnNames *column_names, Arena *arena) {
+    if (arena == nullptr) {
+        ValueDicts *ret = new ValueDicts();
+        for (auto const &handle: *handles)
+            ret->push_back(project(handle, column_names));
+        return ret;
+    }
+    ValueDicts *ret = arena->make<ValueDicts>(ArenaAllocator<ValueDict *>(arena));
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle, column_names);
+        ret->push_back(arena->make<ValueDict>(*row, ValueDict::allocator_type(arena)));
+        delete row;
+    }
     return ret;
 }
 
 // Do a projection for each of a list of handles
-ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
+ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where, Arena *arena) {
     ColumnNames t;
     for (auto const &column: *where)
         t.push_back(column.first);
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle, &t));
-    return ret;
-}
\ No newline at end of file
+    return project(handles, &t, arena);
+}
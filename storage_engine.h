@@ -9,11 +9,14 @@
  */
 #pragma once
 
+#include <cstring>
 #include <exception>
 #include <map>
+#include <string>
 #include <utility>
 #include <vector>
 #include "db_cxx.h"
+#include "Arena.h"
 
 /**
  * Global variable to hold dbenv.
@@ -174,6 +177,11 @@ public:
      */
     virtual void close() = 0;
 
+    /**
+     * Throw away all the blocks, leaving the file as create() does.
+     */
+    virtual void truncate() = 0;
+
     /**
      * Add a new block for this file.
      * @returns  the newly appended block
@@ -210,7 +218,7 @@ protected:
  */
 class ColumnAttribute {
 public:
-    enum DataType {
+    enum DataType : uint8_t {
         INT, TEXT, BOOLEAN
     };
 
@@ -231,36 +239,160 @@ protected:
 
 /**
  * @class Value - holds value for a field
+ *
+ * A Value is a 16-byte tagged union. INT and BOOLEAN values keep their number in n. TEXT values of up to
+ * INLINE_SZ characters are kept entirely within the Value; longer ones keep their first PREFIX_SZ
+ * characters inline (so most comparisons are settled without following the pointer) and point to all
+ * of the characters, which are either owned by the Value or borrowed from an Arena's string dictionary.
+ * A borrowed value (and any copy of it) is only good while that arena lives. Don't change the data_type
+ * of a TEXT value in place; assign a new Value instead.
  */
 class Value {
 public:
+    static const uint INLINE_SZ = 12;
+    static const uint PREFIX_SZ = 4;
+
     ColumnAttribute::DataType data_type;
-    int32_t n;
-    std::string s;
+protected:
+    enum Representation : uint8_t {
+        INLINE, OWNED, BORROWED
+    };
+    Representation rep;  // where a TEXT value's characters are
+    uint16_t length;     // number of characters in a TEXT value
+public:
+    union {
+        int32_t n;
+        char text[INLINE_SZ];  // TEXT: the characters, or the first PREFIX_SZ of them followed by a pointer
+    };
+
+    Value() : data_type(ColumnAttribute::INT), rep(INLINE), length(0), n(0) {}
 
-    Value() : n(0) { data_type = ColumnAttribute::INT; }
+    Value(int32_t n) : data_type(ColumnAttribute::INT), rep(INLINE), length(0), n(n) {}
 
-    Value(int32_t n) : n(n) { data_type = ColumnAttribute::INT; }
+    Value(const std::string &s) : Value(s.data(), s.size()) {}
+
+    Value(const char *s) : Value(s, strlen(s)) {}
+
+    /**
+     * Make a TEXT value.
+     * @param chars  the characters
+     * @param size   number of characters
+     * @param arena  if given, long strings are borrowed from its string dictionary rather than copied
+     * @throws       std::length_error if there are more than UINT16_MAX characters
+     */
+    Value(const char *chars, size_t size, Arena *arena = nullptr);
+
+    Value(const Value &other);
+
+    Value(Value &&temp) noexcept;
+
+    Value &operator=(const Value &other);
+
+    Value &operator=(Value &&temp) noexcept;
+
+    ~Value() {
+        if (this->data_type == ColumnAttribute::TEXT && this->rep == OWNED)
+            delete[] text_pointer();
+    }
+
+    /**
+     * Characters of a TEXT value (not nul-terminated).
+     */
+    const char *text_data() const { return this->rep == INLINE ? this->text : text_pointer(); }
+
+    /**
+     * Number of characters in a TEXT value.
+     */
+    uint16_t text_size() const { return this->length; }
 
-    Value(std::string s) : s(s) { data_type = ColumnAttribute::TEXT; }
+    /**
+     * Copy of the characters of a TEXT value.
+     */
+    std::string s() const { return std::string(text_data(), this->length); }
 
-    bool operator==(const Value &other) const;
+    bool operator==(const Value &other) const {
+        if (this->data_type != other.data_type)
+            return false;
+        if (this->data_type != ColumnAttribute::TEXT)
+            return this->n == other.n;
+        return this->length == other.length && text_compare(other) == 0;
+    }
 
-    bool operator!=(const Value &other) const;
+    bool operator!=(const Value &other) const { return !(*this == other); }
 
-    bool operator<(const Value &other) const;
+    bool operator<(const Value &other) const {
+        if (this->data_type != other.data_type)
+            return type_order(this->data_type) < type_order(other.data_type);
+        if (this->data_type != ColumnAttribute::TEXT)
+            return this->n < other.n;
+        return text_compare(other) < 0;
+    }
 
     friend std::ostream &operator<<(std::ostream &out, const Value &value);
+
+protected:
+    const char *text_pointer() const {
+        const char *p;
+        memcpy(&p, this->text + PREFIX_SZ, sizeof(p));
+        return p;
+    }
+
+    void set_text_pointer(const char *p) { memcpy(this->text + PREFIX_SZ, &p, sizeof(p)); }
+
+    void copy_text(const Value &other);
+
+    int text_compare(const Value &other) const;
+
+    // arbitrary ordering of data types: BOOLEAN < INT < TEXT
+    static int type_order(ColumnAttribute::DataType data_type) {
+        return data_type == ColumnAttribute::BOOLEAN ? 0 : data_type == ColumnAttribute::INT ? 1 : 2;
+    }
 };
 
+static_assert(sizeof(Value) == 16, "Value should stay 16 bytes");
+
 // More type aliases
 typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
+typedef std::vector<uint> ColumnOrdinals;  // positions of columns within a relation's column_names
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
-typedef std::map<Identifier, Value> ValueDict;
-typedef std::vector<ValueDict *> ValueDicts;
+typedef std::map<Identifier, Value, std::less<Identifier>, ArenaAllocator<std::pair<const Identifier, Value> > > ValueDict;
+typedef std::vector<ValueDict *, ArenaAllocator<ValueDict *> > ValueDicts;
+
+
+/**
+ * @class Condition - one comparison of a column against constants, as found in a where clause
+ *
+ * A where clause is a Conjunction: a list of Conditions that must all hold. As with Value::operator==,
+ * comparing a column to a value of another data type never holds.
+ */
+class Condition {
+public:
+    enum Comparison : uint8_t {
+        EQ, LT, LE, GT, GE, BETWEEN, IN
+    };
+
+    Identifier column_name;
+    Comparison comparison;
+    std::vector<Value> operands;  // the value compared to; BETWEEN's low and high (inclusive); IN's list
+
+    Condition(const Identifier &column_name, Comparison comparison, const std::vector<Value> &operands)
+            : column_name(column_name), comparison(comparison), operands(operands) {}
+
+    Condition(const Identifier &column_name, Comparison comparison, const Value &operand)
+            : column_name(column_name), comparison(comparison), operands(1, operand) {}
+
+    /**
+     * The given equalities as a conjunction.
+     * @param where  column values to match (nullptr for none)
+     * @returns      one EQ condition per column
+     */
+    static std::vector<Condition> equalities(const ValueDict *where);
+};
+
+typedef std::vector<Condition> Conjunction;
 
 
 /**
@@ -374,6 +506,42 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * @param where  comparisons that must all hold
+     * @returns      a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(const Conjunction &where) = 0;
+
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * This version does a restricted selection based on current_selection.
+     * @param current_selection  restrict selection to be from these rows
+     * @param where              comparisons that must all hold
+     * @returns                  a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(Handles *current_selection, const Conjunction &where) = 0;
+
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>
+     * @param where  comparisons that must all hold
+     * @param limit  most handles wanted
+     * @returns      the first limit handles select(where) would get (freed by caller)
+     */
+    virtual Handles *select(const Conjunction &where, size_t limit);
+
+    /**
+     * Conceptually, execute: SELECT COUNT(*) FROM <table_name>
+     * @returns  the number of rows
+     */
+    virtual size_t count();
+
+    /**
+     * Execute: TRUNCATE TABLE <table_name> (i.e., DELETE FROM <table_name> with no where clause)
+     * By default this deletes the rows one at a time; a relation can do better by emptying its file.
+     */
+    virtual void truncate();
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -400,11 +568,12 @@ public:
     virtual ValueDict *project(Handle handle, const ValueDict *column_names);
 
     // additional versions of project for multiple rows
-    virtual ValueDicts *project(Handles *handles);
+    // (if given an arena, the returned list and its rows are made there and must not be deleted by the caller)
+    virtual ValueDicts *project(Handles *handles, Arena *arena = nullptr);
 
-    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names);
+    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names, Arena *arena = nullptr);
 
-    virtual ValueDicts *project(Handles *handles, const ValueDict *column_names);
+    virtual ValueDicts *project(Handles *handles, const ValueDict *column_names, Arena *arena = nullptr);
 
     /**
      * Accessor for column_names.
@@ -471,6 +640,11 @@ public:
      */
     virtual void drop() = 0;
 
+    /**
+     * Remove all the entries from this index (when its relation is being truncated).
+     */
+    virtual void truncate() = 0;
+
     /**
      * Open this index.
      */
@@ -483,21 +657,63 @@ public:
 
     /**
      * Lookup a specific search key.
-     * @param key_values  dictionary of values for the search key
+     * @param key_values  dictionary of values for the search key, or for just its leading columns
+     *                    (at least min_lookup_columns() of them)
      * @returns           list of DbFile handles for records with key_values
      */
     virtual Handles *lookup(ValueDict *key_values) const = 0;
 
     /**
-     * Lookup a range of search keys.
-     * @param min_key  dictionary of min (inclusive) search key
-     * @param max_key  dictionary of max (inclusive) search key
-     * @returns        list of DbFile handles for records in range
+     * Lookup each of a batch of search keys (as from an IN list, or the rows on the outer side of a join).
+     * By default this is one lookup() after another; an index can do better by sharing work between the keys.
+     * @param keys  dictionaries of values for the search keys, each as for lookup()
+     * @returns     list of DbFile handles for each key, in the order of keys (each freed by caller)
+     */
+    virtual std::vector<Handles *> lookup_batch(const ValueDicts &keys) const {
+        std::vector<Handles *> results;
+        for (auto const key: keys)
+            results.push_back(lookup(key));
+        return results;
+    }
+
+    /**
+     * How many of the leading search key columns lookup() has to be given.
+     * @returns  all of them by default (as for a hashed index), fewer for an index that can match
+     *           on part of the key, 0 if lookup() is not available at all
+     */
+    virtual uint min_lookup_columns() const { return (uint) key_columns.size(); }
+
+    const ColumnNames &get_key_columns() const { return key_columns; }
+
+    bool is_unique() const { return unique; }
+
+    /**
+     * Whether range() is available (i.e., the index keeps its keys in order).
+     */
+    virtual bool has_range() const { return false; }
+
+    /**
+     * Lookup a range of search keys. Either bound may give just the leading key columns: a row is in range if
+     * its key's leading columns (as many as the bound gives) are no less than min_key and no greater than
+     * max_key.
+     * @param min_key  dictionary of min (inclusive) search key (nullptr for no lower bound)
+     * @param max_key  dictionary of max (inclusive) search key (nullptr for no upper bound)
+     * @returns        list of DbFile handles for records in range, in key order
      */
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const {
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Find the row with the least (or greatest) key, whose leading key column holds that column's least (or
+     * greatest) value.
+     * @param greatest  whether to find the greatest key rather than the least
+     * @returns         list with the DbFile handle of that row, empty if there are no rows
+     */
+    virtual Handles *edge(bool greatest) const {
+        throw DbRelationError("edge index query not supported");
+    }
+
     /**
      * Insert the index entry for the given record.
      * @param record  handle (into relation) to the record to insert
@@ -512,6 +728,17 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Delete the index entries for a batch of records (as for the rows of a DELETE or UPDATE).
+     * By default this is one del() after another; an index can do better by visiting each of its blocks once.
+     * @param records  handles (into relation) to the records to remove
+     *                 (must still be in the relation at time of removal)
+     */
+    virtual void del_batch(const Handles &records) {
+        for (auto const &record: records)
+            del(record);
+    }
+
 protected:
     DbRelation &relation;
     Identifier name;
@@ -519,3 +746,5 @@ protected:
     bool unique;
 };
 
+typedef std::vector<DbIndex *> DbIndexes;
+